@@ -0,0 +1,436 @@
+#include "testApp.h"
+
+#include "ofxInteractivePrimitives.h"
+
+using namespace ofxInteractivePrimitives;
+
+// checks of the picking behavior, run on the CPU without drawing a frame.
+// every check builds its own scene with PICKING_CPU and the camera set by setView()
+
+static const float WIDTH = 1024, HEIGHT = 768;
+
+static stringstream failures;
+static int num_failed = 0;
+
+#define CHECK(cond) check((cond), #cond, __LINE__)
+
+static void check(bool passed, const char *what, int line)
+{
+	if (passed) return;
+	
+	failures << "  failed at line " << line << ": " << what << "\n";
+	num_failed++;
+}
+
+static void setupRoot(RootNode &root)
+{
+	root.setPickingMode(PICKING_CPU);
+	root.setView(ofMatrix4x4(), ofMatrix4x4::newOrthoMatrix(0, WIDTH, HEIGHT, 0, -1, 1), ofRectangle(0, 0, WIDTH, HEIGHT));
+}
+
+// nearest node under a screen point
+static Node* pickAt(RootNode &root, float x, float y)
+{
+	vector<ofVec2f> points(1, ofVec2f(x, y));
+	vector<vector<PointSelection> > result;
+	root.pickupPoints(points, result);
+	
+	return result[0].empty() ? NULL : result[0][0].node;
+}
+
+class CheckRect : public Node
+{
+public:
+	
+	float width;
+	int num_hittests;
+	
+	CheckRect(Node &parent, float x, float y) : width(20), num_hittests(0)
+	{
+		setParent(&parent);
+		setPosition(x, y, 0);
+	}
+	
+	void hittest()
+	{
+		num_hittests++;
+		hitRect(0, 0, width, 20);
+	}
+};
+
+#pragma mark - hit shape cache
+
+static void checkHitShapeCache()
+{
+	RootNode root;
+	setupRoot(root);
+	
+	CheckRect o(root, 100, 100);
+	o.setHitShapeCaching(true);
+	root.update();
+	
+	CHECK(pickAt(root, 110, 110) == &o);
+	CHECK(pickAt(root, 110, 110) == &o);
+	CHECK(o.num_hittests == 1);
+	
+	// the recorded shape is replayed until markHitShapeDirty()
+	o.width = 40;
+	CHECK(pickAt(root, 135, 110) == NULL);
+	
+	o.markHitShapeDirty();
+	root.update();
+	CHECK(pickAt(root, 135, 110) == &o);
+	CHECK(o.num_hittests == 2);
+	
+	// moving the node moves the cached shape without recording it again
+	o.setPosition(300, 100, 0);
+	root.update();
+	CHECK(pickAt(root, 335, 110) == &o);
+	CHECK(pickAt(root, 135, 110) == NULL);
+	CHECK(o.num_hittests == 2);
+	
+	// caching is off by default, hittest() runs on every pick
+	CheckRect p(root, 500, 100);
+	root.update();
+	CHECK(pickAt(root, 510, 110) == &p);
+	CHECK(pickAt(root, 510, 110) == &p);
+	CHECK(p.num_hittests == 2);
+	
+	// the built-in elements whose hittest() only uses the content rect cache it
+	Slider slider(root);
+	StringBox box(root);
+	CHECK(slider.getHitShapeCaching() && box.getHitShapeCaching());
+}
+
+#pragma mark - input coalescing
+
+class CheckLog : public CheckRect
+{
+public:
+	
+	string log;
+	bool move_on_press;
+	
+	CheckLog(Node &parent, float x, float y) : CheckRect(parent, x, y), move_on_press(false) {}
+	
+	void mousePressed(int, int, int)
+	{
+		log += "press ";
+		if (move_on_press) setPosition(600, 600, 0);
+	}
+	
+	void mouseReleased(int, int, int) { log += "release "; }
+	void mouseMoved(int, int) { log += "move "; }
+	void mouseDragged(int, int, int) { log += "drag "; }
+};
+
+static void checkInputCoalescing()
+{
+	RootNode root;
+	setupRoot(root);
+	root.setInputCoalescing(true);
+	
+	CheckLog o(root, 100, 100);
+	root.update();
+	
+	// runs of moves and drags collapse, presses and releases keep their order
+	for (int i = 0; i < 10; i++) root.injectPointerMoved(0, 101 + i, 105);
+	root.injectPointerPressed(0, 110, 105);
+	for (int i = 0; i < 5; i++) root.injectPointerDragged(0, 111 + i, 105);
+	root.injectPointerReleased(0, 115, 105);
+	root.injectPointerPressed(0, 115, 105);
+	root.injectPointerReleased(0, 115, 105);
+	
+	CHECK(o.log.empty());
+	root.update();
+	
+	// released over the node it pressed, the node gets the release twice
+	CHECK(o.log == "move press drag release release press release release ");
+	
+	const InputStats &stats = root.getInputStats();
+	CHECK(stats.events_received == 19);
+	CHECK(stats.events_coalesced == 13);
+	
+	// 9 collapsed moves, then the picks at the position of the last drag are reused
+	CHECK(stats.picks_saved == 12);
+	
+	// a handler that moves the node drops the picks of the flush before it
+	root.resetInputStats();
+	o.log.clear();
+	o.setPosition(100, 100, 0);
+	o.move_on_press = true;
+	root.update();
+	
+	root.injectPointerPressed(0, 110, 105);
+	root.injectPointerReleased(0, 110, 105);
+	root.injectPointerPressed(0, 110, 105);
+	root.update();
+	
+	// the release picks again and misses, the second press reuses that
+	CHECK(o.log == "press release ");
+	CHECK(root.getInputStats().picks_saved == 1);
+}
+
+#pragma mark - spatial index
+
+// same scene for every index type, moved the same way
+struct IndexScene
+{
+	RootNode root;
+	vector<CheckRect*> rects;
+	
+	IndexScene(SpatialIndexType type)
+	{
+		setupRoot(root);
+		root.setSpatialIndex(type);
+		
+		for (int i = 0; i < 200; i++)
+		{
+			CheckRect *o = new CheckRect(root, (i * 37) % 1000, (i * 53) % 740);
+			o->width = 10 + i % 60;
+			
+			// half with local bounds, half with cached shapes
+			if (i % 2) o->setLocalBounds(BoundingBox(ofVec3f(0, 0, 0), ofVec3f(o->width, 20, 0)));
+			else o->setHitShapeCaching(true);
+			
+			rects.push_back(o);
+		}
+		
+		root.update();
+	}
+	
+	~IndexScene()
+	{
+		for (size_t i = 0; i < rects.size(); i++) delete rects[i];
+	}
+	
+	// the index of the nearest rect, -1 for none
+	int pick(float x, float y)
+	{
+		vector<CheckRect*>::iterator it = find(rects.begin(), rects.end(), pickAt(root, x, y));
+		return it != rects.end() ? it - rects.begin() : -1;
+	}
+	
+	void move(int frame)
+	{
+		for (size_t i = frame % 7; i < rects.size(); i += 7)
+			rects[i]->setPosition((i * 91 + frame * 113) % 1000, (i * 29 + frame * 71) % 740, 0);
+		
+		if (frame == 2) rects[3]->setVisible(false);
+		if (frame == 3) rects[3]->setVisible(true);
+		
+		// the grid projects its rects again
+		if (frame % 3 == 1)
+			root.setView(ofMatrix4x4::newTranslationMatrix(ofVec3f(frame * 5, -frame * 3, 0)), ofMatrix4x4::newOrthoMatrix(0, WIDTH, HEIGHT, 0, -1, 1), ofRectangle(0, 0, WIDTH, HEIGHT));
+		
+		// moves at event time and in update() both reach the index
+		if (frame % 2) root.update();
+	}
+};
+
+static void checkSpatialIndex()
+{
+	IndexScene linear(SPATIAL_INDEX_NONE), bvh(SPATIAL_INDEX_BVH), grid(SPATIAL_INDEX_GRID);
+	
+	int num_mismatches = 0;
+	
+	for (int frame = 0; frame < 6; frame++)
+	{
+		for (float y = 5; y < HEIGHT; y += 31)
+		{
+			for (float x = 5; x < WIDTH; x += 37)
+			{
+				const int expected = linear.pick(x, y);
+				if (bvh.pick(x, y) != expected || grid.pick(x, y) != expected) num_mismatches++;
+			}
+		}
+		
+		linear.move(frame);
+		bvh.move(frame);
+		grid.move(frame);
+	}
+	
+	CHECK(num_mismatches == 0);
+	
+	// update() gathers the bounds without hittest()
+	const int before = bvh.rects[1]->num_hittests;
+	bvh.rects[1]->setPosition(500, 500, 0);
+	bvh.root.update();
+	CHECK(bvh.rects[1]->num_hittests == before);
+}
+
+#pragma mark - node handles
+
+static void checkNodeHandles()
+{
+	RootNode root;
+	setupRoot(root);
+	
+	CheckRect *a = new CheckRect(root, 100, 100);
+	NodeHandle handle_a = a->getHandle();
+	CHECK(handle_a.get() == a);
+	
+	// a disposed node does not resolve, even when the next node takes its slot
+	a->dispose();
+	delete a;
+	CHECK(handle_a.get() == NULL);
+	
+	CheckRect *b = new CheckRect(root, 100, 100);
+	NodeHandle handle_b = b->getHandle();
+	CHECK(handle_b.get() == b);
+	CHECK(handle_a.get() == NULL);
+	
+	// clearChildren() unregisters every subtree and bumps the scene version once
+	Node group;
+	group.setParent(&root);
+	
+	vector<CheckRect*> rects;
+	vector<NodeHandle> handles;
+	
+	for (int i = 0; i < 100; i++)
+	{
+		rects.push_back(new CheckRect(group, i * 10, 200));
+		rects.push_back(new CheckRect(*rects.back(), 0, 10));
+		handles.push_back(rects[rects.size() - 2]->getHandle());
+		handles.push_back(rects.back()->getHandle());
+	}
+	
+	const unsigned int version = root.getSceneVersion();
+	group.clearChildren();
+	
+	CHECK(root.getSceneVersion() == version + 1);
+	CHECK(group.getNumChildren() == 0);
+	
+	int num_resolved = 0;
+	for (size_t i = 0; i < handles.size(); i++)
+		if (handles[i].get()) num_resolved++;
+	
+	CHECK(num_resolved == 0);
+	CHECK(rects[0]->getParent() == NULL && rects[1]->getParent() == rects[0]);
+	
+	for (size_t i = 0; i < rects.size(); i++) delete rects[i];
+	
+	// the freed slots come back with new generations
+	CheckRect c(root, 300, 100);
+	CHECK(c.getHandle().get() == &c);
+	
+	for (size_t i = 0; i < handles.size(); i++)
+		if (handles[i].get()) num_resolved++;
+	
+	CHECK(num_resolved == 0);
+	
+	root.update();
+	CHECK(pickAt(root, 105, 105) == b && pickAt(root, 305, 105) == &c);
+	
+	b->dispose();
+	delete b;
+}
+
+string result;
+
+//--------------------------------------------------------------
+static void runChecks()
+{
+	struct { const char *name; void (*run)(); } checks[] = {
+		{ "hit shape cache", checkHitShapeCache },
+		{ "input coalescing", checkInputCoalescing },
+		{ "node handles", checkNodeHandles },
+		{ "spatial index", checkSpatialIndex }
+	};
+	const int num_checks = sizeof(checks) / sizeof(checks[0]);
+	
+	stringstream ss;
+	
+	for (int i = 0; i < num_checks; i++)
+	{
+		failures.str("");
+		
+		const int failed_before = num_failed;
+		checks[i].run();
+		
+		ss << (num_failed == failed_before ? "ok     " : "FAILED ") << checks[i].name << "\n" << failures.str();
+	}
+	
+	ss << "\n" << num_failed << " failed\n\npress space to run again";
+	num_failed = 0;
+	
+	result = ss.str();
+	cout << result << endl;
+}
+
+//--------------------------------------------------------------
+void testApp::setup()
+{
+	ofSetFrameRate(60);
+	ofSetVerticalSync(true);
+	ofBackground(0);
+
+	runChecks();
+}
+
+//--------------------------------------------------------------
+void testApp::update()
+{
+
+}
+
+//--------------------------------------------------------------
+void testApp::draw()
+{
+	ofSetColor(255);
+	ofDrawBitmapString(result, 20, 30);
+}
+
+//--------------------------------------------------------------
+void testApp::keyPressed(int key)
+{
+	if (key == ' ') runChecks();
+}
+
+//--------------------------------------------------------------
+void testApp::keyReleased(int key)
+{
+
+}
+
+//--------------------------------------------------------------
+void testApp::mouseMoved(int x, int y)
+{
+
+}
+
+//--------------------------------------------------------------
+void testApp::mouseDragged(int x, int y, int button)
+{
+
+}
+
+//--------------------------------------------------------------
+void testApp::mousePressed(int x, int y, int button)
+{
+
+}
+
+//--------------------------------------------------------------
+void testApp::mouseReleased(int x, int y, int button)
+{
+
+}
+
+//--------------------------------------------------------------
+void testApp::windowResized(int w, int h)
+{
+
+}
+
+//--------------------------------------------------------------
+void testApp::gotMessage(ofMessage msg)
+{
+
+}
+
+//--------------------------------------------------------------
+void testApp::dragEvent(ofDragInfo dragInfo)
+{
+
+}
@@ -0,0 +1,11 @@
+#include "testApp.h"
+#include "ofAppGlutWindow.h"
+
+//--------------------------------------------------------------
+int main()
+{
+	ofAppGlutWindow window; // create a window
+	// set width, height, mode (OF_WINDOW or OF_FULLSCREEN)
+	ofSetupOpenGL(&window, 1024, 768, OF_WINDOW);
+	ofRunApp(new testApp()); // start the app
+}
\ No newline at end of file
@@ -0,0 +1,257 @@
+#include "testApp.h"
+
+#include "ofxInteractivePrimitives.h"
+
+using namespace ofxInteractivePrimitives;
+
+// random tree stored level by level, nodes[0] is the root
+struct Tree
+{
+	vector<int> parent;
+	vector<int> level;
+	vector<ofMatrix4x4> local;
+
+	vector<ofMatrix4x4> global, global_inverse;
+
+	// the same tree as ofNodes, for the path before the kernel
+	vector<ofNode> nodes;
+
+	void setup(int num_nodes)
+	{
+		parent.assign(num_nodes, -1);
+		level.assign(num_nodes, 0);
+		local.resize(num_nodes);
+		global.resize(num_nodes);
+		global_inverse.resize(num_nodes);
+
+		ofNode n;
+
+		for (int i = 0; i < num_nodes; i++)
+		{
+			if (i > 0)
+			{
+				// mostly shallow, like a UI or a scene graph of props
+				parent[i] = ofRandom(0, min(i, 64));
+				if (ofRandom(1) < 0.3) parent[i] = ofRandom(0, i);
+
+				level[i] = level[parent[i]] + 1;
+			}
+
+			n.setPosition(ofRandom(-100, 100), ofRandom(-100, 100), ofRandom(-100, 100));
+			n.setOrientation(ofVec3f(ofRandom(360), ofRandom(360), ofRandom(360)));
+			n.setScale(ofRandom(0.5, 2));
+
+			local[i] = n.getLocalTransformMatrix();
+		}
+
+		// renumber by level, so both paths walk memory in order
+		vector<pair<int, int> > order(num_nodes);
+		for (int i = 0; i < num_nodes; i++) order[i] = make_pair(level[i], i);
+		stable_sort(order.begin(), order.end());
+
+		vector<int> new_index(num_nodes);
+		for (int i = 0; i < num_nodes; i++) new_index[order[i].second] = i;
+
+		vector<int> old_parent = parent;
+		vector<ofMatrix4x4> old_local = local;
+
+		for (int i = 0; i < num_nodes; i++)
+		{
+			const int o = order[i].second;
+			level[i] = order[i].first;
+			parent[i] = o > 0 ? new_index[old_parent[o]] : -1;
+			local[i] = old_local[o];
+		}
+
+		// sized once, the parents are pointers into it
+		nodes.assign(num_nodes, ofNode());
+
+		for (int i = 0; i < num_nodes; i++)
+		{
+			nodes[i].setTransformMatrix(local[i]);
+			local[i] = nodes[i].getLocalTransformMatrix();
+			if (i > 0) nodes[i].setParent(nodes[parent[i]]);
+		}
+	}
+};
+
+// what Node::update() did per node: getGlobalTransformMatrix() walks up to the root,
+// then a full 4x4 inverse
+static void updatePerNode(Tree &tree)
+{
+	for (size_t i = 0; i < tree.nodes.size(); i++)
+	{
+		tree.global[i] = tree.nodes[i].getGlobalTransformMatrix();
+		tree.global_inverse[i] = tree.global[i].getInverse();
+	}
+}
+
+// what RootNode::update() does now: kernel runs over the nodes of a tree level
+static void updateBatched(Tree &tree, vector<vector<int> > &levels, TransformKernel &kernel)
+{
+	tree.global[0] = tree.local[0];
+	tree.global_inverse[0] = tree.global[0].getInverse();
+
+	for (size_t l = 1; l < levels.size(); l++)
+	{
+		const vector<int> &nodes = levels[l];
+
+		for (size_t first = 0; first < nodes.size(); first += TransformKernel::BATCH_SIZE)
+		{
+			const size_t last = min(nodes.size(), first + TransformKernel::BATCH_SIZE);
+
+			kernel.clear();
+			for (size_t i = first; i < last; i++)
+				kernel.add(tree.global[tree.parent[nodes[i]]], tree.local[nodes[i]]);
+
+			kernel.run();
+
+			for (size_t i = first; i < last; i++)
+				kernel.get(i - first, tree.global[nodes[i]], tree.global_inverse[nodes[i]]);
+		}
+	}
+}
+
+static float maxError(const vector<ofMatrix4x4> &a, const vector<ofMatrix4x4> &b)
+{
+	float e = 0;
+
+	for (size_t i = 0; i < a.size(); i++)
+	{
+		for (int k = 0; k < 16; k++)
+		{
+			const float x = a[i].getPtr()[k], y = b[i].getPtr()[k];
+			e = max(e, fabsf(x - y) / max(1.f, fabsf(y)));
+		}
+	}
+
+	return e;
+}
+
+string result;
+
+//--------------------------------------------------------------
+static void runBenchmark()
+{
+	const int sizes[] = { 1000, 10000, 100000 };
+	const int num_runs = 20;
+
+	stringstream ss;
+	ss << "transform kernel: " << TransformKernel::getInstructionSet() << "\n\n";
+	ss << "   nodes   per node (ms)    batched (ms)   speedup   max error\n";
+
+	TransformKernel kernel;
+
+	for (int s = 0; s < 3; s++)
+	{
+		Tree tree;
+		tree.setup(sizes[s]);
+
+		vector<vector<int> > levels;
+		for (size_t i = 0; i < tree.level.size(); i++)
+		{
+			if (tree.level[i] >= levels.size()) levels.resize(tree.level[i] + 1);
+			levels[tree.level[i]].push_back(i);
+		}
+
+		unsigned long long t0 = ofGetElapsedTimeMicros();
+		for (int i = 0; i < num_runs; i++) updatePerNode(tree);
+		unsigned long long t1 = ofGetElapsedTimeMicros();
+
+		vector<ofMatrix4x4> reference = tree.global_inverse;
+
+		for (int i = 0; i < num_runs; i++) updateBatched(tree, levels, kernel);
+		unsigned long long t2 = ofGetElapsedTimeMicros();
+
+		const double per_node = (t1 - t0) / 1000.0 / num_runs;
+		const double batched = (t2 - t1) / 1000.0 / num_runs;
+
+		ss << setw(8) << sizes[s]
+		   << setw(16) << fixed << setprecision(3) << per_node
+		   << setw(16) << batched
+		   << setw(9) << setprecision(2) << per_node / batched << "x"
+		   << setw(12) << scientific << setprecision(1) << maxError(tree.global_inverse, reference) << "\n";
+	}
+
+	ss << "\npress space to run again";
+
+	result = ss.str();
+	cout << result << endl;
+}
+
+//--------------------------------------------------------------
+void testApp::setup()
+{
+	ofSetFrameRate(60);
+	ofSetVerticalSync(true);
+	ofBackground(0);
+
+	runBenchmark();
+}
+
+//--------------------------------------------------------------
+void testApp::update()
+{
+
+}
+
+//--------------------------------------------------------------
+void testApp::draw()
+{
+	ofSetColor(255);
+	ofDrawBitmapString(result, 20, 30);
+}
+
+//--------------------------------------------------------------
+void testApp::keyPressed(int key)
+{
+	if (key == ' ') runBenchmark();
+}
+
+//--------------------------------------------------------------
+void testApp::keyReleased(int key)
+{
+
+}
+
+//--------------------------------------------------------------
+void testApp::mouseMoved(int x, int y)
+{
+
+}
+
+//--------------------------------------------------------------
+void testApp::mouseDragged(int x, int y, int button)
+{
+
+}
+
+//--------------------------------------------------------------
+void testApp::mousePressed(int x, int y, int button)
+{
+
+}
+
+//--------------------------------------------------------------
+void testApp::mouseReleased(int x, int y, int button)
+{
+
+}
+
+//--------------------------------------------------------------
+void testApp::windowResized(int w, int h)
+{
+
+}
+
+//--------------------------------------------------------------
+void testApp::gotMessage(ofMessage msg)
+{
+
+}
+
+//--------------------------------------------------------------
+void testApp::dragEvent(ofDragInfo dragInfo)
+{
+
+}
@@ -0,0 +1,252 @@
+#pragma once
+
+#include "ofMain.h"
+
+OFX_INTERACTIVE_PRIMITIVES_START_NAMESPACE
+
+#pragma mark - GLStateCache
+
+// the few states the library changes: color, fill, line width and blend mode of
+// the OF style, and GL capabilities like the depth test. setters skip values that
+// are already current, and begin() / end() restore only the states that changed,
+// instead of pushing every attribute. also loads matrices without the fixed
+// function pipeline. for the GL thread only
+class GLStateCache
+{
+public:
+
+	static GLStateCache& get()
+	{
+		static GLStateCache cache;
+		return cache;
+	}
+
+	// saves the style, capabilities are saved when first set. scopes nest
+	void begin()
+	{
+		// outside code may have changed anything since the last frame
+		if (scopes.empty())
+		{
+			capabilities.clear();
+			color_valid = false;
+		}
+
+		const ofStyle style = ofGetStyle();
+
+		Scope s;
+		s.color = style.color;
+		s.fill = style.bFill;
+		s.line_width = style.lineWidth;
+		s.blend_mode = style.blendingMode;
+		s.first_capability = saved_capabilities.size();
+
+		scopes.push_back(s);
+	}
+
+	// restores what differs from begin(), including changes made around the cache
+	void end()
+	{
+		assert(!scopes.empty());
+
+		const Scope s = scopes.back();
+		scopes.pop_back();
+
+		setColor(s.color);
+		setFill(s.fill);
+		setLineWidth(s.line_width);
+		setBlendMode(s.blend_mode);
+
+		while (saved_capabilities.size() > s.first_capability)
+		{
+			const Capability &c = saved_capabilities.back();
+			applyCapability(findCapability(c.cap), c.enabled);
+			saved_capabilities.pop_back();
+		}
+	}
+
+	// back to the style saved by the innermost begin() without closing the scope,
+	// before drawing code that expects the style of the app. capabilities are kept
+	void restoreStyle()
+	{
+		if (scopes.empty()) return;
+
+		const Scope &s = scopes.back();
+		setColor(s.color);
+		setFill(s.fill);
+		setLineWidth(s.line_width);
+		setBlendMode(s.blend_mode);
+	}
+
+	// the color saved by the innermost begin(), for primitives drawn in the color of the app
+	void restoreColor()
+	{
+		if (!scopes.empty()) setColor(scopes.back().color);
+	}
+
+	void setColor(const ofColor& c)
+	{
+		if (color_valid && ofGetStyle().color == c) return;
+
+		ofSetColor(c);
+		color_valid = true;
+		num_changes++;
+	}
+
+	void setColor(int r, int g, int b, int a = 255) { setColor(ofColor(r, g, b, a)); }
+
+	// after drawing with color arrays, where the GL color is undefined
+	void invalidateColor() { color_valid = false; }
+
+	void setFill(bool yn)
+	{
+		if (ofGetFill() == yn) return;
+
+		if (yn) ofFill();
+		else ofNoFill();
+
+		num_changes++;
+	}
+
+	void setLineWidth(float w)
+	{
+		if (ofGetStyle().lineWidth == w) return;
+
+		ofSetLineWidth(w);
+		num_changes++;
+	}
+
+	void setBlendMode(ofBlendMode m)
+	{
+		if (ofGetStyle().blendingMode == m) return;
+
+		ofEnableBlendMode(m);
+		num_changes++;
+	}
+
+	// glEnable / glDisable, raw GL changes to cap are not seen until the scope ends
+	void setCapability(GLenum cap, bool yn)
+	{
+		int i = findCapability(cap);
+
+		if (i < 0)
+		{
+			Capability c;
+			c.cap = cap;
+			c.enabled = glIsEnabled(cap);
+			capabilities.push_back(c);
+
+			i = capabilities.size() - 1;
+		}
+
+		// the first change in a scope saves the value for end()
+		if (!scopes.empty() && !isSaved(cap))
+			saved_capabilities.push_back(capabilities[i]);
+
+		applyCapability(i, yn);
+	}
+
+	void setDepthTest(bool yn) { setCapability(GL_DEPTH_TEST, yn); }
+	
+	// saves and loads both matrices. through OF with ofGLProgrammableRenderer,
+	// raw GL otherwise, where the matrices of the app may be unknown to OF
+	void pushMatrices(const ofMatrix4x4& projection, const ofMatrix4x4& modelview)
+	{
+		if (ofIsGLProgrammableRenderer())
+		{
+			ofSetMatrixMode(OF_MATRIX_PROJECTION);
+			ofPushMatrix();
+			ofLoadMatrix(projection);
+			
+			ofSetMatrixMode(OF_MATRIX_MODELVIEW);
+			ofPushMatrix();
+			ofLoadMatrix(modelview);
+			return;
+		}
+		
+		glMatrixMode(GL_PROJECTION);
+		glPushMatrix();
+		glLoadMatrixf(projection.getPtr());
+		
+		glMatrixMode(GL_MODELVIEW);
+		glPushMatrix();
+		glLoadMatrixf(modelview.getPtr());
+	}
+	
+	void popMatrices()
+	{
+		if (ofIsGLProgrammableRenderer())
+		{
+			ofSetMatrixMode(OF_MATRIX_PROJECTION);
+			ofPopMatrix();
+			ofSetMatrixMode(OF_MATRIX_MODELVIEW);
+			ofPopMatrix();
+			return;
+		}
+		
+		glMatrixMode(GL_PROJECTION);
+		glPopMatrix();
+		glMatrixMode(GL_MODELVIEW);
+		glPopMatrix();
+	}
+
+	// states set through the cache, restores included
+	unsigned int getNumChanges() const { return num_changes; }
+
+protected:
+
+	struct Scope
+	{
+		ofColor color;
+		bool fill;
+		float line_width;
+		ofBlendMode blend_mode;
+		size_t first_capability;
+	};
+
+	struct Capability
+	{
+		GLenum cap;
+		bool enabled;
+	};
+
+	vector<Scope> scopes;
+
+	// known values, queried again in the next outermost scope
+	vector<Capability> capabilities;
+	vector<Capability> saved_capabilities;
+
+	bool color_valid;
+	unsigned int num_changes;
+
+	GLStateCache() : color_valid(false), num_changes(0) {}
+
+	void applyCapability(int i, bool yn)
+	{
+		Capability &c = capabilities[i];
+		if (c.enabled == yn) return;
+
+		if (yn) glEnable(c.cap);
+		else glDisable(c.cap);
+
+		c.enabled = yn;
+		num_changes++;
+	}
+
+	int findCapability(GLenum cap) const
+	{
+		for (size_t i = 0; i < capabilities.size(); i++)
+			if (capabilities[i].cap == cap) return i;
+
+		return -1;
+	}
+
+	bool isSaved(GLenum cap) const
+	{
+		for (size_t i = scopes.back().first_capability; i < saved_capabilities.size(); i++)
+			if (saved_capabilities[i].cap == cap) return true;
+
+		return false;
+	}
+};
+
+OFX_INTERACTIVE_PRIMITIVES_END_NAMESPACE
@@ -0,0 +1,625 @@
+#pragma once
+
+#include "ofMain.h"
+
+#include <float.h>
+
+#include "ofxIPGLStateCache.h"
+
+OFX_INTERACTIVE_PRIMITIVES_START_NAMESPACE
+
+#pragma mark - Ray
+
+struct Ray
+{
+	// points between near plane (t = 0) and far plane (t = 1)
+	ofVec3f origin, direction;
+
+	Ray() {}
+	Ray(const ofVec3f& near_pos, const ofVec3f& far_pos) : origin(near_pos), direction(far_pos - near_pos) {}
+
+	inline ofVec3f getPoint(float t) const { return origin + direction * t; }
+
+	// affine transforms keep t, so hits in local space can be compared with each other
+	inline Ray transformed(const ofMatrix4x4& m) const
+	{
+		return Ray(m.preMult(origin), m.preMult(getPoint(1)));
+	}
+};
+
+#pragma mark - BoundingBox
+
+struct BoundingBox
+{
+	ofVec3f min_pos, max_pos;
+
+	BoundingBox() : min_pos(FLT_MAX, FLT_MAX, FLT_MAX), max_pos(-FLT_MAX, -FLT_MAX, -FLT_MAX) {}
+	BoundingBox(const ofVec3f& a, const ofVec3f& b) : min_pos(a), max_pos(a) { add(b); }
+
+	inline bool isEmpty() const { return min_pos.x > max_pos.x; }
+
+	inline void add(const ofVec3f& p)
+	{
+		min_pos.x = std::min(min_pos.x, p.x);
+		min_pos.y = std::min(min_pos.y, p.y);
+		min_pos.z = std::min(min_pos.z, p.z);
+		max_pos.x = std::max(max_pos.x, p.x);
+		max_pos.y = std::max(max_pos.y, p.y);
+		max_pos.z = std::max(max_pos.z, p.z);
+	}
+
+	inline void add(const BoundingBox& o)
+	{
+		if (o.isEmpty()) return;
+		add(o.min_pos);
+		add(o.max_pos);
+	}
+
+	inline ofVec3f getCenter() const { return (min_pos + max_pos) * 0.5; }
+	inline ofVec3f getSize() const { return max_pos - min_pos; }
+
+	inline ofVec3f getCorner(int i) const
+	{
+		return ofVec3f(i & 1 ? max_pos.x : min_pos.x,
+					   i & 2 ? max_pos.y : min_pos.y,
+					   i & 4 ? max_pos.z : min_pos.z);
+	}
+
+	BoundingBox transformed(const ofMatrix4x4& m) const
+	{
+		BoundingBox b;
+		if (isEmpty()) return b;
+
+		for (int i = 0; i < 8; i++)
+			b.add(m.preMult(getCorner(i)));
+
+		return b;
+	}
+
+	inline bool operator==(const BoundingBox& o) const { return min_pos == o.min_pos && max_pos == o.max_pos; }
+	inline bool operator!=(const BoundingBox& o) const { return !(*this == o); }
+
+	inline void expand(float v)
+	{
+		if (isEmpty()) return;
+		min_pos -= ofVec3f(v, v, v);
+		max_pos += ofVec3f(v, v, v);
+	}
+
+	inline bool intersects(const BoundingBox& o) const
+	{
+		return min_pos.x <= o.max_pos.x && max_pos.x >= o.min_pos.x
+			&& min_pos.y <= o.max_pos.y && max_pos.y >= o.min_pos.y
+			&& min_pos.z <= o.max_pos.z && max_pos.z >= o.min_pos.z;
+	}
+
+	// slab test, t is clipped to the near/far range of the ray
+	bool intersects(const Ray& ray, float &t) const
+	{
+		float t0 = 0, t1 = 1;
+
+		for (int i = 0; i < 3; i++)
+		{
+			const float o = ray.origin[i];
+			const float d = ray.direction[i];
+
+			if (fabs(d) < FLT_EPSILON)
+			{
+				if (o < min_pos[i] || o > max_pos[i]) return false;
+				continue;
+			}
+
+			float n = (min_pos[i] - o) / d;
+			float f = (max_pos[i] - o) / d;
+			if (n > f) std::swap(n, f);
+
+			t0 = std::max(t0, n);
+			t1 = std::min(t1, f);
+
+			if (t0 > t1) return false;
+		}
+
+		t = t0;
+		return true;
+	}
+};
+
+#pragma mark - HitShape
+
+// geometry declared from Node::hittest(), in node local coordinates
+struct HitShape
+{
+	enum Type
+	{
+		RECT,
+		CIRCLE,
+		SEGMENT,
+		POLYGON,
+		BOX,
+		ORIENTED_BOX,
+		MESH,
+		POINT
+	};
+
+	Type type;
+
+	// RECT, BOX: min / max corner
+	// CIRCLE, POINT: p0 is center
+	// SEGMENT: end points
+	ofVec3f p0, p1;
+
+	// CIRCLE: radius, SEGMENT: line width in pixel, POINT: point size in pixel
+	float size;
+
+	union
+	{
+		// ORIENTED_BOX: unit cube to local space, as ofMatrix4x4::getPtr()
+		float matrix[16];
+
+		// POLYGON, MESH: the arrays of the caller, only valid while the shape is issued.
+		// HitShapeRecorder keeps copies for the replays
+		struct
+		{
+			const ofVec3f *vertices;
+			const ofIndexType *indices;
+			unsigned int num_vertices, num_indices;
+			ofPrimitiveMode mode;
+		} mesh;
+	};
+
+	HitShape(Type type = RECT) : type(type), size(0)
+	{
+		mesh.vertices = NULL;
+		mesh.indices = NULL;
+		mesh.num_vertices = mesh.num_indices = 0;
+		mesh.mode = OF_PRIMITIVE_TRIANGLES;
+	}
+
+	// SEGMENT and POINT have a size in pixel, so they are tested in screen space
+	inline bool isScreenSpace() const { return type == SEGMENT || type == POINT; }
+
+	inline bool hasVertices() const { return type == POLYGON || type == MESH; }
+
+	inline ofMatrix4x4 getMatrix() const { return ofMatrix4x4(matrix); }
+
+	bool intersects(const Ray& ray, float &t) const
+	{
+		switch (type)
+		{
+			case RECT:
+			{
+				ofVec3f p;
+				if (!intersectPlaneZ(ray, p0.z, t, p)) return false;
+				return p.x >= p0.x && p.x <= p1.x && p.y >= p0.y && p.y <= p1.y;
+			}
+
+			case CIRCLE:
+			{
+				ofVec3f p;
+				if (!intersectPlaneZ(ray, p0.z, t, p)) return false;
+				return p.squareDistance(p0) <= size * size;
+			}
+
+			case POLYGON:
+				return intersectPolygon(ray, t);
+
+			case BOX:
+				return BoundingBox(p0, p1).intersects(ray, t);
+
+			case ORIENTED_BOX:
+				return BoundingBox(ofVec3f(-0.5, -0.5, -0.5), ofVec3f(0.5, 0.5, 0.5))
+					.intersects(ray.transformed(getMatrix().getInverse()), t);
+
+			case MESH:
+				return intersectMesh(ray, t);
+
+			default:
+				return false;
+		}
+	}
+
+	// local bounds, SEGMENT and POINT still need their pixel size around it
+	BoundingBox getBounds() const
+	{
+		BoundingBox b;
+
+		switch (type)
+		{
+			case RECT:
+			case SEGMENT:
+			case BOX:
+			case POINT:
+				b.add(p0);
+				b.add(p1);
+				break;
+
+			case CIRCLE:
+				b.add(p0 - ofVec3f(size, size, 0));
+				b.add(p0 + ofVec3f(size, size, 0));
+				break;
+
+			case POLYGON:
+			case MESH:
+				for (size_t i = 0; i < mesh.num_vertices; i++)
+					b.add(mesh.vertices[i]);
+				break;
+
+			case ORIENTED_BOX:
+				b = BoundingBox(ofVec3f(-0.5, -0.5, -0.5), ofVec3f(0.5, 0.5, 0.5)).transformed(getMatrix());
+				break;
+		}
+
+		return b;
+	}
+
+	void draw() const
+	{
+		switch (type)
+		{
+			case RECT:
+				ofDrawRectangle(p0.x, p0.y, p0.z, p1.x - p0.x, p1.y - p0.y);
+				break;
+
+			case CIRCLE:
+				ofDrawCircle(p0, size);
+				break;
+
+			case SEGMENT:
+				GLStateCache::get().setLineWidth(size);
+				ofDrawLine(p0, p1);
+				break;
+
+			case POLYGON:
+				ofBeginShape();
+				for (size_t i = 0; i < mesh.num_vertices; i++)
+					ofVertex(mesh.vertices[i]);
+				ofEndShape(true);
+				break;
+
+			case BOX:
+			{
+				const ofVec3f s = p1 - p0;
+				ofDrawBox((p0 + p1) * 0.5, s.x, s.y, s.z);
+				break;
+			}
+
+			case ORIENTED_BOX:
+				ofPushMatrix();
+				ofMultMatrix(getMatrix());
+				ofDrawBox(ofVec3f(0, 0, 0), 1, 1, 1);
+				ofPopMatrix();
+				break;
+
+			case MESH:
+			{
+				static ofMesh m;
+				m.clear();
+				m.setMode(mesh.mode);
+				m.getVertices().assign(mesh.vertices, mesh.vertices + mesh.num_vertices);
+				m.getIndices().assign(mesh.indices, mesh.indices + mesh.num_indices);
+				m.draw();
+				break;
+			}
+
+			case POINT:
+			{
+				// no glBegin(), it is not there with core profiles
+				static ofMesh point_mesh;
+				point_mesh.clear();
+				point_mesh.setMode(OF_PRIMITIVE_POINTS);
+				point_mesh.addVertex(p0);
+				
+				glPointSize(size);
+				point_mesh.draw();
+				break;
+			}
+		}
+	}
+
+	// factories
+
+	static HitShape rect(const ofRectangle& r)
+	{
+		HitShape s(RECT);
+		s.p0.set(r.getMinX(), r.getMinY(), 0);
+		s.p1.set(r.getMaxX(), r.getMaxY(), 0);
+		return s;
+	}
+
+	static HitShape circle(const ofVec3f& center, float radius)
+	{
+		HitShape s(CIRCLE);
+		s.p0 = center;
+		s.size = radius;
+		return s;
+	}
+
+	static HitShape segment(const ofVec3f& p0, const ofVec3f& p1, float width)
+	{
+		HitShape s(SEGMENT);
+		s.p0 = p0;
+		s.p1 = p1;
+		s.size = width;
+		return s;
+	}
+
+	static HitShape polygon(const vector<ofVec3f>& vertices)
+	{
+		HitShape s(POLYGON);
+		s.mesh.vertices = vertices.empty() ? NULL : &vertices[0];
+		s.mesh.num_vertices = vertices.size();
+		return s;
+	}
+
+	static HitShape box(const ofVec3f& a, const ofVec3f& b)
+	{
+		BoundingBox bb(a, b);
+
+		HitShape s(BOX);
+		s.p0 = bb.min_pos;
+		s.p1 = bb.max_pos;
+		return s;
+	}
+
+	static HitShape orientedBox(const ofMatrix4x4& m, const ofVec3f& size)
+	{
+		HitShape s(ORIENTED_BOX);
+		const ofMatrix4x4 matrix = ofMatrix4x4::newScaleMatrix(size) * m;
+		memcpy(s.matrix, matrix.getPtr(), sizeof(s.matrix));
+		return s;
+	}
+
+	static HitShape fromMesh(const ofMesh& mesh)
+	{
+		HitShape s(MESH);
+		s.mesh.vertices = mesh.getVerticesPointer();
+		s.mesh.indices = mesh.getIndexPointer();
+		s.mesh.num_vertices = mesh.getNumVertices();
+		s.mesh.num_indices = mesh.getNumIndices();
+		s.mesh.mode = mesh.getMode();
+		return s;
+	}
+
+	static HitShape point(const ofVec3f& p, float size)
+	{
+		HitShape s(POINT);
+		s.p0 = s.p1 = p;
+		s.size = size;
+		return s;
+	}
+
+protected:
+
+	static bool intersectPlaneZ(const Ray& ray, float z, float &t, ofVec3f &p)
+	{
+		if (fabs(ray.direction.z) < FLT_EPSILON) return false;
+
+		t = (z - ray.origin.z) / ray.direction.z;
+		if (t < 0 || t > 1) return false;
+
+		p = ray.getPoint(t);
+		return true;
+	}
+
+	static bool intersectTriangle(const Ray& ray, const ofVec3f& v0, const ofVec3f& v1, const ofVec3f& v2, float &t)
+	{
+		const ofVec3f e1 = v1 - v0;
+		const ofVec3f e2 = v2 - v0;
+		const ofVec3f p = ray.direction.getCrossed(e2);
+
+		const float det = e1.dot(p);
+		if (fabs(det) < FLT_EPSILON) return false;
+
+		const float inv_det = 1.0 / det;
+		const ofVec3f s = ray.origin - v0;
+
+		const float u = s.dot(p) * inv_det;
+		if (u < 0 || u > 1) return false;
+
+		const ofVec3f q = s.getCrossed(e1);
+		const float v = ray.direction.dot(q) * inv_det;
+		if (v < 0 || u + v > 1) return false;
+
+		t = e2.dot(q) * inv_det;
+		return t >= 0 && t <= 1;
+	}
+
+	bool intersectPolygon(const Ray& ray, float &t) const
+	{
+		const ofVec3f *vertices = mesh.vertices;
+		const size_t num_vertices = mesh.num_vertices;
+		if (num_vertices < 3) return false;
+
+		// newell's method
+		ofVec3f n;
+		for (size_t i = 0; i < num_vertices; i++)
+		{
+			const ofVec3f& a = vertices[i];
+			const ofVec3f& b = vertices[(i + 1) % num_vertices];
+
+			n.x += (a.y - b.y) * (a.z + b.z);
+			n.y += (a.z - b.z) * (a.x + b.x);
+			n.z += (a.x - b.x) * (a.y + b.y);
+		}
+
+		const float denom = n.dot(ray.direction);
+		if (fabs(denom) < FLT_EPSILON) return false;
+
+		t = n.dot(vertices[0] - ray.origin) / denom;
+		if (t < 0 || t > 1) return false;
+
+		const ofVec3f p = ray.getPoint(t);
+
+		// drop the dominant axis and test in 2D
+		int u = 0, v = 1;
+		if (fabs(n.x) >= fabs(n.y) && fabs(n.x) >= fabs(n.z)) { u = 1; v = 2; }
+		else if (fabs(n.y) >= fabs(n.z)) { u = 0; v = 2; }
+
+		bool inside = false;
+		for (size_t i = 0, j = num_vertices - 1; i < num_vertices; j = i++)
+		{
+			const ofVec3f& a = vertices[i];
+			const ofVec3f& b = vertices[j];
+
+			if ((a[v] > p[v]) != (b[v] > p[v])
+				&& p[u] < (b[u] - a[u]) * (p[v] - a[v]) / (b[v] - a[v]) + a[u])
+				inside = !inside;
+		}
+
+		return inside;
+	}
+
+	bool intersectMesh(const Ray& ray, float &t) const
+	{
+		const ofPrimitiveMode mode = mesh.mode;
+		if (mode != OF_PRIMITIVE_TRIANGLES
+			&& mode != OF_PRIMITIVE_TRIANGLE_STRIP
+			&& mode != OF_PRIMITIVE_TRIANGLE_FAN) return false;
+
+		const ofVec3f *vertices = mesh.vertices;
+		const ofIndexType *indices = mesh.indices;
+		const bool indexed = mesh.num_indices > 0;
+		const size_t n = indexed ? mesh.num_indices : mesh.num_vertices;
+
+		bool hit = false;
+		t = FLT_MAX;
+
+		for (size_t i = 2; i < n; i += (mode == OF_PRIMITIVE_TRIANGLES ? 3 : 1))
+		{
+			size_t i0 = i - 2, i1 = i - 1, i2 = i;
+			if (mode == OF_PRIMITIVE_TRIANGLE_FAN) i0 = 0;
+
+			const ofVec3f &v0 = vertices[indexed ? indices[i0] : i0];
+			const ofVec3f &v1 = vertices[indexed ? indices[i1] : i1];
+			const ofVec3f &v2 = vertices[indexed ? indices[i2] : i2];
+
+			float tt;
+			if (intersectTriangle(ray, v0, v1, v2, tt) && tt < t)
+			{
+				t = tt;
+				hit = true;
+			}
+		}
+
+		return hit;
+	}
+};
+
+#pragma mark - HitTestTarget
+
+// receives the name stack and shapes issued from Node::hittest()
+class HitTestTarget
+{
+public:
+
+	virtual ~HitTestTarget() {}
+
+	virtual void pushName(GLuint name) = 0;
+	virtual void popName() = 0;
+	virtual void addShape(const HitShape& shape) = 0;
+};
+
+#pragma mark - HitShapeRecorder
+
+// records a hittest() so it can be replayed into other targets without running it again
+class HitShapeRecorder : public HitTestTarget
+{
+public:
+
+	void clear()
+	{
+		ops.clear();
+		shapes.clear();
+		offsets.clear();
+		vertices.clear();
+		indices.clear();
+	}
+
+	bool empty() const { return shapes.empty(); }
+
+	void pushName(GLuint name) { ops.push_back(Op(PUSH_NAME, name)); }
+	void popName() { ops.push_back(Op(POP_NAME, 0)); }
+
+	// POLYGON and MESH arrays are copied, the pointers are set again on replay
+	void addShape(const HitShape& shape)
+	{
+		ops.push_back(Op(ADD_SHAPE, shapes.size()));
+		shapes.push_back(shape);
+		offsets.push_back(make_pair(vertices.size(), indices.size()));
+
+		if (shape.hasVertices())
+		{
+			vertices.insert(vertices.end(), shape.mesh.vertices, shape.mesh.vertices + shape.mesh.num_vertices);
+			indices.insert(indices.end(), shape.mesh.indices, shape.mesh.indices + shape.mesh.num_indices);
+		}
+	}
+
+	void replay(HitTestTarget &target) const
+	{
+		for (size_t i = 0; i < ops.size(); i++)
+		{
+			const Op &op = ops[i];
+
+			switch (op.type)
+			{
+				case PUSH_NAME: target.pushName(op.value); break;
+				case POP_NAME: target.popName(); break;
+				case ADD_SHAPE: target.addShape(getShape(op.value)); break;
+			}
+		}
+	}
+
+	size_t getNumShapes() const { return shapes.size(); }
+
+	// the shape pointing into the copied arrays
+	HitShape getShape(size_t i) const
+	{
+		HitShape s = shapes[i];
+
+		if (s.hasVertices())
+		{
+			s.mesh.vertices = s.mesh.num_vertices ? &vertices[offsets[i].first] : NULL;
+			s.mesh.indices = s.mesh.num_indices ? &indices[offsets[i].second] : NULL;
+		}
+
+		return s;
+	}
+
+	// local bounds of the shapes, and the largest pixel size of screen space shapes
+	BoundingBox getBounds(float *pixel_size = NULL) const
+	{
+		BoundingBox b;
+		float size = 0;
+
+		for (size_t i = 0; i < shapes.size(); i++)
+		{
+			b.add(getShape(i).getBounds());
+			if (shapes[i].isScreenSpace()) size = max(size, shapes[i].size);
+		}
+
+		if (pixel_size) *pixel_size = size;
+		return b;
+	}
+
+protected:
+
+	enum OpType { PUSH_NAME, POP_NAME, ADD_SHAPE };
+
+	struct Op
+	{
+		OpType type;
+		GLuint value;
+
+		Op(OpType type, GLuint value) : type(type), value(value) {}
+	};
+
+	vector<Op> ops;
+	vector<HitShape> shapes;
+
+	// by shape, where its vertices and indices start
+	vector<pair<size_t, size_t> > offsets;
+	vector<ofVec3f> vertices;
+	vector<ofIndexType> indices;
+};
+
+OFX_INTERACTIVE_PRIMITIVES_END_NAMESPACE
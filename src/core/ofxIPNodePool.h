@@ -0,0 +1,312 @@
+#pragma once
+
+#include "ofMain.h"
+
+#include <mutex>
+
+OFX_INTERACTIVE_PRIMITIVES_START_NAMESPACE
+
+#pragma mark - FixedBlockPool
+
+// blocks of one size carved from chunks. every block remembers its chunk, so a
+// chunk whose blocks are all free goes back to the global allocator. one empty
+// chunk is kept around, so creating and deleting a single node doesn't thrash
+class FixedBlockPool
+{
+public:
+
+	enum
+	{
+		ALIGNMENT = 16
+	};
+
+	FixedBlockPool(size_t object_size, size_t blocks_per_chunk)
+		: object_size(object_size)
+		, block_size(roundUp(HEADER_SIZE + max<size_t>(object_size, 1)))
+		, blocks_per_chunk(max<size_t>(blocks_per_chunk, 1))
+		, available(NULL), num_chunks(0), num_empty_chunks(0), num_allocated(0), num_free(0) {}
+
+	// chunks still holding blocks are left alone, their nodes outlive the pool
+	~FixedBlockPool()
+	{
+		releaseEmptyChunks(0);
+	}
+
+	void* allocate()
+	{
+		if (!available) addChunk();
+
+		Chunk *c = available;
+		FreeBlock *b = c->free_list;
+		c->free_list = b->next;
+
+		if (c->num_used++ == 0) num_empty_chunks--;
+		if (!c->free_list) unlink(c);
+
+		num_free--;
+		num_allocated++;
+
+		return (char*)b + HEADER_SIZE;
+	}
+
+	void deallocate(void *p)
+	{
+		char *block = (char*)p - HEADER_SIZE;
+		Chunk *c = *(Chunk**)block;
+
+		if (!c->free_list) link(c);
+
+		FreeBlock *b = (FreeBlock*)block;
+		b->next = c->free_list;
+		c->free_list = b;
+
+		num_free++;
+		num_allocated--;
+
+		if (--c->num_used == 0)
+		{
+			num_empty_chunks++;
+			if (num_empty_chunks > 1) releaseChunk(c);
+		}
+	}
+
+	// makes sure n more blocks are handed out without touching the global allocator
+	void reserve(size_t n)
+	{
+		while (num_free < n) addChunk();
+	}
+
+	size_t getObjectSize() const { return object_size; }
+	size_t getNumAllocated() const { return num_allocated; }
+	size_t getNumFree() const { return num_free; }
+	size_t getNumChunks() const { return num_chunks; }
+	size_t getNumReservedBytes() const { return num_chunks * getChunkBytes(); }
+
+protected:
+
+	struct Chunk;
+
+	// blocks start with a pointer to their chunk, padded to keep objects aligned
+	struct FreeBlock
+	{
+		Chunk *chunk;
+		FreeBlock *next;
+	};
+
+	struct Chunk
+	{
+		Chunk *prev, *next;
+		FreeBlock *free_list;
+		size_t num_used;
+	};
+
+	enum
+	{
+		HEADER_SIZE = (sizeof(Chunk*) + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT,
+		CHUNK_HEADER_SIZE = (sizeof(Chunk) + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT
+	};
+
+	size_t object_size, block_size, blocks_per_chunk;
+
+	// chunks with at least one free block
+	Chunk *available;
+
+	size_t num_chunks, num_empty_chunks;
+	size_t num_allocated, num_free;
+
+	static size_t roundUp(size_t n)
+	{
+		n = max<size_t>(n, sizeof(FreeBlock));
+		return (n + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+	}
+
+	size_t getChunkBytes() const { return CHUNK_HEADER_SIZE + block_size * blocks_per_chunk; }
+
+	void link(Chunk *c)
+	{
+		c->prev = NULL;
+		c->next = available;
+		if (available) available->prev = c;
+		available = c;
+	}
+
+	void unlink(Chunk *c)
+	{
+		if (c->prev) c->prev->next = c->next;
+		else available = c->next;
+		if (c->next) c->next->prev = c->prev;
+		c->prev = c->next = NULL;
+	}
+
+	void addChunk()
+	{
+		char *mem = (char*)::operator new(getChunkBytes());
+
+		Chunk *c = (Chunk*)mem;
+		c->free_list = NULL;
+		c->num_used = 0;
+
+		// threaded back to front, so the first block is handed out first
+		char *blocks = mem + CHUNK_HEADER_SIZE;
+		for (size_t i = blocks_per_chunk; i-- > 0; )
+		{
+			FreeBlock *b = (FreeBlock*)(blocks + i * block_size);
+			b->chunk = c;
+			b->next = c->free_list;
+			c->free_list = b;
+		}
+
+		link(c);
+
+		num_chunks++;
+		num_empty_chunks++;
+		num_free += blocks_per_chunk;
+	}
+
+	void releaseChunk(Chunk *c)
+	{
+		unlink(c);
+
+		num_chunks--;
+		num_empty_chunks--;
+		num_free -= blocks_per_chunk;
+
+		::operator delete(c);
+	}
+
+	void releaseEmptyChunks(size_t keep)
+	{
+		Chunk *c = available;
+		while (c && num_empty_chunks > keep)
+		{
+			Chunk *next = c->next;
+			if (c->num_used == 0) releaseChunk(c);
+			c = next;
+		}
+	}
+};
+
+#pragma mark - NodePool
+
+// the pool behind OFX_INTERACTIVE_PRIMITIVES_POOLED_NODE(T). only objects of
+// exactly sizeof(T) are pooled, bigger subclasses go to the global allocator
+template <typename T>
+class NodePool
+{
+public:
+
+	enum
+	{
+		CHUNK_SIZE = 16 * 1024
+	};
+
+	struct Stats
+	{
+		size_t num_allocated;
+		size_t num_free;
+		size_t num_reserved_bytes;
+
+		Stats() : num_allocated(0), num_free(0), num_reserved_bytes(0) {}
+	};
+
+	// destroyed at exit like any static. nodes deleted by later static
+	// destructors see shut_down and leave their block to the process
+	static NodePool& get()
+	{
+		static NodePool pool;
+		return pool;
+	}
+
+	static void* allocate(size_t size)
+	{
+		if (size == sizeof(T) && !shut_down)
+		{
+			NodePool &self = get();
+			std::lock_guard<std::mutex> lock(self.mutex);
+			return self.pool.allocate();
+		}
+
+		return ::operator new(size);
+	}
+
+	// size has to be the size passed to allocate()
+	static void deallocate(void *p, size_t size)
+	{
+		if (!p) return;
+
+		if (size == sizeof(T))
+		{
+			if (shut_down) return;
+
+			NodePool &self = get();
+			std::lock_guard<std::mutex> lock(self.mutex);
+			self.pool.deallocate(p);
+			return;
+		}
+
+		::operator delete(p);
+	}
+
+	// preallocates before building a large scene
+	void reserve(size_t n)
+	{
+		if (shut_down) return;
+
+		std::lock_guard<std::mutex> lock(mutex);
+		pool.reserve(n);
+	}
+
+	Stats getStats()
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+
+		Stats s;
+		s.num_allocated = pool.getNumAllocated();
+		s.num_free = pool.getNumFree();
+		s.num_reserved_bytes = pool.getNumReservedBytes();
+		return s;
+	}
+
+protected:
+
+	FixedBlockPool pool;
+	std::mutex mutex;
+
+	static bool shut_down;
+
+	NodePool() : pool(sizeof(T), CHUNK_SIZE / sizeof(T)) {}
+	~NodePool() { shut_down = true; }
+};
+
+template <typename T>
+bool NodePool<T>::shut_down = false;
+
+// opts a node class into its own pool. put it in the public section:
+//
+//   class Particle : public ofxInteractivePrimitives::Node
+//   {
+//   public:
+//       OFX_INTERACTIVE_PRIMITIVES_POOLED_NODE(Particle)
+//       ...
+//   };
+//
+// subclasses inherit the operators, but only objects of the same size share
+// the pool. define OFX_INTERACTIVE_PRIMITIVES_NO_NODE_POOL to turn pooling off
+#ifndef OFX_INTERACTIVE_PRIMITIVES_NO_NODE_POOL
+#define OFX_INTERACTIVE_PRIMITIVES_POOLED_NODE(T) \
+	static void* operator new(size_t size) { return ofx::InteractivePrimitives::NodePool<T>::allocate(size); } \
+	static void operator delete(void *p, size_t size) { ofx::InteractivePrimitives::NodePool<T>::deallocate(p, size); }
+#else
+#define OFX_INTERACTIVE_PRIMITIVES_POOLED_NODE(T)
+#endif
+
+// e.g. reserveNodes<Marker>(1000) before creating a thousand markers
+template <typename T>
+inline void reserveNodes(size_t n)
+{
+#ifndef OFX_INTERACTIVE_PRIMITIVES_NO_NODE_POOL
+	NodePool<T>::get().reserve(n);
+#endif
+}
+
+OFX_INTERACTIVE_PRIMITIVES_END_NAMESPACE
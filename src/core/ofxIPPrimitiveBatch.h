@@ -0,0 +1,326 @@
+#pragma once
+
+#include "ofMain.h"
+
+#include "ofxIPTextBatch.h"
+
+OFX_INTERACTIVE_PRIMITIVES_START_NAMESPACE
+
+#pragma mark - PrimitiveBatch
+
+// collects the rects, lines and strings of many nodes in world space and draws
+// them on flush(). the calls mirror ofSetColor, ofFill, ofDrawRectangle,
+// ofDrawLine and ofDrawBitmapString, in the local coordinates of the matrix
+// passed to setTransform().
+// a flush keeps the painter's order: consecutive primitives of the same type
+// are one run, and the runs are drawn in the order they were recorded.
+// recording touches no GL state, so batches may be filled on other threads
+// and appended to the one that draws
+class PrimitiveBatch
+{
+public:
+
+	// how much was collected, see append()
+	struct Mark
+	{
+		size_t fills, lines, text, runs;
+
+		Mark() : fills(0), lines(0), text(0), runs(0) {}
+
+		size_t get(int kind) const { return kind == FILLS ? fills : kind == LINES ? lines : text; }
+	};
+
+	PrimitiveBatch() : fill(true), num_draw_calls(0)
+	{
+		fills.setMode(OF_PRIMITIVE_TRIANGLES);
+		lines.setMode(OF_PRIMITIVE_LINES);
+	}
+
+	// the current style is the style every node starts with. text is anchored
+	// through modelview_projection, the view the transforms are relative to
+	void begin(const ofMatrix4x4& modelview_projection, const ofRectangle& viewport)
+	{
+		text.begin(modelview_projection, viewport);
+
+		const ofStyle style = ofGetStyle();
+		base_color = style.color;
+		base_fill = style.bFill;
+
+		clear();
+		num_draw_calls = 0;
+
+		resetStyle();
+	}
+
+	// draws what is left, the GL color is the base color again
+	void end()
+	{
+		flush();
+		GLStateCache::get().setColor(base_color);
+	}
+
+	void setTransform(const ofMatrix4x4& m) { matrix = m; }
+	const ofMatrix4x4& getTransform() const { return matrix; }
+
+	// back to the style of begin()
+	void resetStyle()
+	{
+		color = base_color;
+		fill = base_fill;
+	}
+
+	void setColor(const ofColor& c) { color = c; }
+	void setColor(int r, int g, int b, int a = 255) { color = ofColor(r, g, b, a); }
+	const ofColor& getColor() const { return color; }
+
+	void setFill(bool yn) { fill = yn; }
+	bool getFill() const { return fill; }
+
+	void drawLine(float x0, float y0, float x1, float y1)
+	{
+		addLine(toWorld(x0, y0), toWorld(x1, y1));
+	}
+
+	void drawRectangle(float x, float y, float w, float h)
+	{
+		const ofVec3f p0 = toWorld(x, y);
+		const ofVec3f p1 = toWorld(x + w, y);
+		const ofVec3f p2 = toWorld(x + w, y + h);
+		const ofVec3f p3 = toWorld(x, y + h);
+
+		if (fill)
+		{
+			addTriangle(p0, p1, p2);
+			addTriangle(p0, p2, p3);
+		}
+		else
+		{
+			addLine(p0, p1);
+			addLine(p1, p2);
+			addLine(p2, p3);
+			addLine(p3, p0);
+		}
+	}
+
+	void drawRectangle(const ofRectangle& r) { drawRectangle(r.x, r.y, r.width, r.height); }
+
+	// like ofDrawBitmapString, prefer drawText() with a layout kept by the node
+	void drawString(const string& s, float x, float y)
+	{
+		scratch_layout.setText(s);
+		drawText(scratch_layout, x, y);
+	}
+
+	void drawText(const TextLayout& layout, float x, float y)
+	{
+		const size_t begin = text.getNumVertices();
+		text.add(layout, toWorld(x, y), color);
+		addRun(TEXT, begin, text.getNumVertices());
+	}
+
+	Mark getMark() const
+	{
+		Mark m;
+		m.fills = fills.getNumVertices();
+		m.lines = lines.getNumVertices();
+		m.text = text.getNumVertices();
+		m.runs = runs.size();
+		return m;
+	}
+
+	// what src collected between two of its marks, src began with the same view.
+	// the run open at from may have grown since, so it is clipped to the marks
+	void append(const PrimitiveBatch& src, const Mark& from, const Mark& to)
+	{
+		for (size_t r = from.runs > 0 ? from.runs - 1 : 0; r < to.runs; r++)
+		{
+			const Run &run = src.runs[r];
+			const size_t b = max(run.begin, from.get(run.kind));
+			const size_t e = min(run.end, to.get(run.kind));
+			if (e <= b) continue;
+
+			switch (run.kind)
+			{
+				case FILLS:
+					appendRange(fills, src.fills, b, e);
+					break;
+
+				case LINES:
+					appendRange(lines, src.lines, b, e);
+					break;
+
+				case TEXT:
+					text.append(src.text, b, e);
+					break;
+			}
+
+			const size_t end = getNumVertices(run.kind);
+			addRun(run.kind, end - (e - b), end);
+		}
+	}
+
+	bool empty() const
+	{
+		return fills.getNumVertices() == 0 && lines.getNumVertices() == 0 && text.empty();
+	}
+
+	// draws and clears what was collected, one draw call per run. call before
+	// drawing anything else, so it lands on top of the batch
+	void flush()
+	{
+		if (empty()) return;
+
+		if (fills.getNumVertices() > 0) fill_vbo.setMesh(fills, GL_STREAM_DRAW);
+		if (lines.getNumVertices() > 0) line_vbo.setMesh(lines, GL_STREAM_DRAW);
+
+		for (size_t i = 0; i < runs.size(); i++)
+		{
+			const Run &run = runs[i];
+
+			switch (run.kind)
+			{
+				case FILLS: fill_vbo.draw(GL_TRIANGLES, run.begin, run.end - run.begin); break;
+				case LINES: line_vbo.draw(GL_LINES, run.begin, run.end - run.begin); break;
+				case TEXT: text.draw(run.begin, run.end); break;
+			}
+
+			num_draw_calls++;
+		}
+
+		clear();
+
+		// the color arrays leave the current color undefined
+		GLStateCache &gl_state = GLStateCache::get();
+		gl_state.invalidateColor();
+		gl_state.setColor(base_color);
+	}
+
+	// draw calls issued by flush() since begin()
+	unsigned int getNumDrawCalls() const { return num_draw_calls; }
+
+	// the batch TextLayout::draw() adds to, NULL outside RootNode::draw(). returns
+	// the previous one, to be set again after the draw of a nested root
+	static PrimitiveBatch* setCurrent(PrimitiveBatch *batch)
+	{
+		PrimitiveBatch *prev = current();
+		current() = batch;
+		return prev;
+	}
+
+	static PrimitiveBatch* getCurrent() { return current(); }
+
+protected:
+
+	enum { FILLS, LINES, TEXT };
+
+	// vertices begin..end of one primitive type
+	struct Run
+	{
+		int kind;
+		size_t begin, end;
+
+		Run(int kind, size_t begin, size_t end) : kind(kind), begin(begin), end(end) {}
+	};
+
+	ofMesh fills, lines;
+	ofVbo fill_vbo, line_vbo;
+	TextBatch text;
+	vector<Run> runs;
+	TextLayout scratch_layout;
+
+	ofMatrix4x4 matrix;
+
+	ofColor color, base_color;
+	bool fill, base_fill;
+
+	unsigned int num_draw_calls;
+
+	static PrimitiveBatch*& current()
+	{
+		static PrimitiveBatch *batch = NULL;
+		return batch;
+	}
+
+	// row vectors, like the matrices of the arena
+	inline ofVec3f toWorld(float x, float y) const
+	{
+		return matrix.preMult(ofVec3f(x, y, 0));
+	}
+
+	size_t getNumVertices(int kind) const
+	{
+		return kind == FILLS ? fills.getNumVertices() : kind == LINES ? lines.getNumVertices() : text.getNumVertices();
+	}
+
+	// extends the last run when it is of the same type
+	void addRun(int kind, size_t begin, size_t end)
+	{
+		if (end <= begin) return;
+
+		if (!runs.empty() && runs.back().kind == kind && runs.back().end == begin)
+			runs.back().end = end;
+		else
+			runs.push_back(Run(kind, begin, end));
+	}
+
+	void addLine(const ofVec3f& p0, const ofVec3f& p1)
+	{
+		const ofFloatColor c(color);
+
+		lines.addVertex(p0);
+		lines.addColor(c);
+		lines.addVertex(p1);
+		lines.addColor(c);
+
+		addRun(LINES, lines.getNumVertices() - 2, lines.getNumVertices());
+	}
+
+	void addTriangle(const ofVec3f& p0, const ofVec3f& p1, const ofVec3f& p2)
+	{
+		const ofFloatColor c(color);
+
+		fills.addVertex(p0);
+		fills.addColor(c);
+		fills.addVertex(p1);
+		fills.addColor(c);
+		fills.addVertex(p2);
+		fills.addColor(c);
+
+		addRun(FILLS, fills.getNumVertices() - 3, fills.getNumVertices());
+	}
+
+	static void appendRange(ofMesh& dst, const ofMesh& src, size_t from, size_t to)
+	{
+		dst.addVertices(&src.getVertices()[from], to - from);
+		dst.addColors(&src.getColors()[from], to - from);
+	}
+
+	void clear()
+	{
+		fills.clear();
+		lines.clear();
+		text.clear();
+		runs.clear();
+	}
+};
+
+// at the transform the batch has for the node being drawn, so matrices pushed
+// inside Node::draw() do not move the text. outside a root it is ofDrawBitmapString()
+inline void TextLayout::draw(float x, float y) const
+{
+	if (empty()) return;
+
+	const ofStyle style = ofGetStyle();
+	PrimitiveBatch *batch = PrimitiveBatch::getCurrent();
+
+	if (!batch || style.drawBitmapMode != OF_BITMAPMODE_MODEL_BILLBOARD)
+	{
+		ofDrawBitmapString(text, x, y);
+		return;
+	}
+
+	batch->setColor(style.color);
+	batch->drawText(*this, x, y);
+}
+
+OFX_INTERACTIVE_PRIMITIVES_END_NAMESPACE
@@ -0,0 +1,362 @@
+#pragma once
+
+#include "ofMain.h"
+
+#include "ofxIPHitShape.h"
+
+OFX_INTERACTIVE_PRIMITIVES_START_NAMESPACE
+
+class Node;
+
+#pragma mark - SceneArena
+
+// hot per node data in parallel arrays indexed by slot. the tree is kept as
+// first child / next sibling links, and getOrder() lists the slots depth first
+// with each subtree as a contiguous range. siblings are drawn in link order, the
+// order is patched in place when a node moves among its siblings.
+// released slots are reused, ids pair the slot with a generation so ids of
+// released nodes no longer resolve. a slot is retired instead of reused when its
+// generation runs out. 0 is never a valid id
+class SceneArena
+{
+public:
+
+	enum { NONE = -1 };
+	
+	enum
+	{
+		ID_SLOT_BITS = 20,
+		ID_SLOT_MASK = (1 << ID_SLOT_BITS) - 1,
+		ID_GENERATION_MASK = (1 << (32 - ID_SLOT_BITS)) - 1
+	};
+
+	enum Flag
+	{
+		VISIBLE = 1 << 0,
+		ENABLE = 1 << 1,
+		TRANSFORM_DIRTY = 1 << 2,
+		
+		// the global matrix changed since draw_bounds was computed
+		BOUNDS_DIRTY = 1 << 3,
+		
+		// the node reported draw bounds
+		HAS_DRAW_BOUNDS = 1 << 4,
+		
+		// every visible node of the subtree has draw bounds, subtree_bounds is current
+		CULLABLE = 1 << 5,
+		
+		// the global matrix or the hit shapes changed since hit_bounds was computed
+		HIT_BOUNDS_DIRTY = 1 << 6,
+		
+		// shown on an update worker, invalidateCulling() of the parent is still to do
+		CULLING_DEFERRED = 1 << 7
+	};
+
+	vector<Node*> node;
+
+	vector<int> parent, first_child, last_child, prev_sibling, next_sibling;
+	vector<int> depth;
+	vector<unsigned char> flags;
+
+	// local is copied from the node when its transform is dirty
+	vector<ofMatrix4x4> local, global, global_inverse;
+
+	// world space bounds of the hit shapes, hit_bounds without the padding of pixel sized shapes
+	vector<BoundingBox> bounds, hit_bounds;
+	vector<float> pixel_pad;
+	
+	// draw bounds as the node reported them, in world space, and of the whole subtree
+	vector<BoundingBox> local_draw_bounds, draw_bounds, subtree_bounds;
+
+	SceneArena() : order_dirty(true) {}
+
+	int allocate(Node *o)
+	{
+		int slot;
+
+		if (free_slots.empty())
+		{
+			slot = node.size();
+			assert(slot < ID_SLOT_MASK);
+
+			node.push_back(o);
+			generation.push_back(0);
+			parent.push_back(NONE);
+			first_child.push_back(NONE);
+			last_child.push_back(NONE);
+			prev_sibling.push_back(NONE);
+			next_sibling.push_back(NONE);
+			depth.push_back(0);
+			flags.push_back(0);
+			local.push_back(ofMatrix4x4());
+			global.push_back(ofMatrix4x4());
+			global_inverse.push_back(ofMatrix4x4());
+			bounds.push_back(BoundingBox());
+			hit_bounds.push_back(BoundingBox());
+			pixel_pad.push_back(0);
+			local_draw_bounds.push_back(BoundingBox());
+			draw_bounds.push_back(BoundingBox());
+			subtree_bounds.push_back(BoundingBox());
+			order_index.push_back(NONE);
+			subtree_end.push_back(NONE);
+		}
+		else
+		{
+			slot = free_slots.back();
+			free_slots.pop_back();
+
+			node[slot] = o;
+			parent[slot] = first_child[slot] = last_child[slot] = NONE;
+			prev_sibling[slot] = next_sibling[slot] = NONE;
+			depth[slot] = 0;
+			local[slot] = global[slot] = global_inverse[slot] = ofMatrix4x4();
+			bounds[slot] = hit_bounds[slot] = BoundingBox();
+			local_draw_bounds[slot] = draw_bounds[slot] = subtree_bounds[slot] = BoundingBox();
+			pixel_pad[slot] = 0;
+		}
+
+		flags[slot] = VISIBLE | ENABLE | TRANSFORM_DIRTY | BOUNDS_DIRTY | HIT_BOUNDS_DIRTY;
+		order_dirty = true;
+
+		return slot;
+	}
+
+	// children of the slot are detached, not released
+	void release(int slot)
+	{
+		unlink(slot);
+
+		int c = first_child[slot];
+		while (c != NONE)
+		{
+			const int next = next_sibling[c];
+			parent[c] = prev_sibling[c] = next_sibling[c] = NONE;
+			c = next;
+		}
+
+		first_child[slot] = last_child[slot] = NONE;
+		node[slot] = NULL;
+		flags[slot] = 0;
+		order_dirty = true;
+
+		// wrapping around would resolve the oldest ids of the slot again
+		if (generation[slot] == ID_GENERATION_MASK) return;
+
+		generation[slot]++;
+		free_slots.push_back(slot);
+	}
+
+	// inserts slot as a child of parent_slot in front of the sibling before,
+	// NONE appends it as the last child
+	void link(int slot, int parent_slot, int before = NONE)
+	{
+		unlink(slot);
+		insertSibling(slot, parent_slot, before);
+
+		flags[slot] |= TRANSFORM_DIRTY;
+		invalidateCulling(parent_slot);
+		order_dirty = true;
+	}
+
+	void unlink(int slot)
+	{
+		if (parent[slot] == NONE) return;
+
+		removeSibling(slot);
+		order_dirty = true;
+	}
+
+	// moves slot in front of its sibling before, NONE for the last child. the
+	// subtree is rotated into place in the order, instead of rebuilding it
+	void moveBefore(int slot, int before)
+	{
+		const int p = parent[slot];
+		assert(p != NONE && before != slot);
+
+		if (next_sibling[slot] == before) return;
+
+		// the order is current and holds the parent
+		const bool patch = !order_dirty && order_index[p] != NONE;
+
+		int from = 0, to = 0;
+		if (patch)
+		{
+			from = order_index[slot];
+			to = before != NONE ? order_index[before] : subtree_end[p];
+		}
+
+		removeSibling(slot);
+		insertSibling(slot, p, before);
+
+		if (!patch)
+		{
+			order_dirty = true;
+			return;
+		}
+
+		const int end = subtree_end[slot];
+
+		if (to < from)
+		{
+			std::rotate(order.begin() + to, order.begin() + from, order.begin() + end);
+			updateOrderIndices(to, end);
+		}
+		else
+		{
+			std::rotate(order.begin() + from, order.begin() + end, order.begin() + to);
+			updateOrderIndices(from, to);
+		}
+	}
+
+	// allocate() may be called this many times more
+	inline size_t getNumFreeSlots() const
+	{
+		return free_slots.size() + (ID_SLOT_MASK - node.size());
+	}
+
+	inline unsigned int getId(int slot) const
+	{
+		return (generation[slot] << ID_SLOT_BITS) | (slot + 1);
+	}
+
+	// NONE for 0 and the ids of released slots
+	inline int findSlot(unsigned int id) const
+	{
+		const int slot = (int)(id & ID_SLOT_MASK) - 1;
+		if (slot < 0 || slot >= (int)node.size()) return NONE;
+		if (node[slot] == NULL || getId(slot) != id) return NONE;
+		return slot;
+	}
+
+	inline bool hasFlag(int slot, Flag f) const { return (flags[slot] & f) != 0; }
+
+	inline void setFlag(int slot, Flag f, bool yn)
+	{
+		if (yn) flags[slot] |= f;
+		else flags[slot] &= ~f;
+	}
+
+	// the subtree bounds of the slot and its parents miss a node until they are rebuilt
+	inline void invalidateCulling(int slot)
+	{
+		for (int s = slot; s != NONE && (flags[s] & CULLABLE); s = parent[s])
+			flags[s] &= ~CULLABLE;
+	}
+
+	// depth first order of the tree below root, root included
+	const vector<int>& getOrder(int root)
+	{
+		if (order_dirty || order.empty() || order[0] != root) buildOrder(root);
+		return order;
+	}
+
+	bool isOrderDirty() const { return order_dirty; }
+
+	// position of the slot in getOrder(), and the position after its subtree
+	inline int getOrderIndex(int slot) const { return order_index[slot]; }
+	inline int getSubtreeEnd(int slot) const { return subtree_end[slot]; }
+
+protected:
+
+	vector<unsigned int> generation;
+	vector<int> free_slots;
+
+	vector<int> order, order_index, subtree_end;
+	bool order_dirty;
+
+	vector<int> stack;
+
+	void insertSibling(int slot, int parent_slot, int before)
+	{
+		const int prev = before != NONE ? prev_sibling[before] : last_child[parent_slot];
+
+		parent[slot] = parent_slot;
+		prev_sibling[slot] = prev;
+		next_sibling[slot] = before;
+
+		if (prev != NONE) next_sibling[prev] = slot;
+		else first_child[parent_slot] = slot;
+
+		if (before != NONE) prev_sibling[before] = slot;
+		else last_child[parent_slot] = slot;
+	}
+
+	void removeSibling(int slot)
+	{
+		const int p = parent[slot];
+
+		if (prev_sibling[slot] != NONE)
+			next_sibling[prev_sibling[slot]] = next_sibling[slot];
+		else
+			first_child[p] = next_sibling[slot];
+
+		if (next_sibling[slot] != NONE)
+			prev_sibling[next_sibling[slot]] = prev_sibling[slot];
+		else
+			last_child[p] = prev_sibling[slot];
+
+		parent[slot] = prev_sibling[slot] = next_sibling[slot] = NONE;
+	}
+
+	// after a rotation of whole subtrees, each of them moved as one block
+	void updateOrderIndices(int first, int last)
+	{
+		for (int i = first; i < last; i++)
+		{
+			const int s = order[i];
+			subtree_end[s] += i - order_index[s];
+			order_index[s] = i;
+		}
+	}
+
+	void buildOrder(int root)
+	{
+		order.clear();
+		std::fill(order_index.begin(), order_index.end(), (int)NONE);
+
+		stack.clear();
+		stack.push_back(root);
+		depth[root] = 0;
+
+		while (!stack.empty())
+		{
+			const int s = stack.back();
+			stack.pop_back();
+
+			order_index[s] = order.size();
+			order.push_back(s);
+
+			// pushed in reverse so the first child comes out first
+			for (int c = last_child[s]; c != NONE; c = prev_sibling[c])
+			{
+				depth[c] = depth[s] + 1;
+				stack.push_back(c);
+			}
+		}
+
+		// a subtree ends where the next node of the same or a lower depth starts
+		stack.clear();
+		for (size_t i = 0; i < order.size(); i++)
+		{
+			const int s = order[i];
+
+			while (!stack.empty() && depth[stack.back()] >= depth[s])
+			{
+				subtree_end[stack.back()] = i;
+				stack.pop_back();
+			}
+
+			stack.push_back(s);
+		}
+
+		while (!stack.empty())
+		{
+			subtree_end[stack.back()] = order.size();
+			stack.pop_back();
+		}
+
+		order_dirty = false;
+	}
+};
+
+OFX_INTERACTIVE_PRIMITIVES_END_NAMESPACE
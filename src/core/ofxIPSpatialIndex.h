@@ -0,0 +1,470 @@
+#pragma once
+
+#include "ofMain.h"
+
+#include "ofxIPHitShape.h"
+
+#include <limits>
+
+OFX_INTERACTIVE_PRIMITIVES_START_NAMESPACE
+
+#pragma mark - Frustum
+
+struct Frustum
+{
+	// plane: dot(normal, p) + distance >= 0 is inside
+	ofVec3f normal[6];
+	float distance[6];
+
+	Frustum() {}
+
+	// world_to_clip is modelview * projection. the region is in normalized device
+	// coordinates, so a pick region gives a sub frustum like gluPickMatrix
+	Frustum(const ofMatrix4x4& world_to_clip, float x0 = -1, float y0 = -1, float x1 = 1, float y1 = 1)
+	{
+		const ofMatrix4x4& m = world_to_clip;
+
+		for (int i = 0; i < 6; i++)
+		{
+			// rows of the column vector convention are columns here
+			float c[4];
+			for (int k = 0; k < 4; k++)
+			{
+				const float x = m(k, 0), y = m(k, 1), z = m(k, 2), w = m(k, 3);
+
+				switch (i)
+				{
+					case 0: c[k] = x - x0 * w; break;
+					case 1: c[k] = x1 * w - x; break;
+					case 2: c[k] = y - y0 * w; break;
+					case 3: c[k] = y1 * w - y; break;
+					case 4: c[k] = z + w; break;
+					case 5: c[k] = w - z; break;
+				}
+			}
+
+			normal[i].set(c[0], c[1], c[2]);
+			distance[i] = c[3];
+		}
+	}
+
+	bool intersects(const BoundingBox& b) const
+	{
+		if (b.isEmpty()) return false;
+
+		for (int i = 0; i < 6; i++)
+		{
+			const ofVec3f& n = normal[i];
+
+			// the corner furthest along the plane normal
+			const ofVec3f p(n.x >= 0 ? b.max_pos.x : b.min_pos.x,
+							n.y >= 0 ? b.max_pos.y : b.min_pos.y,
+							n.z >= 0 ? b.max_pos.z : b.min_pos.z);
+
+			if (n.dot(p) + distance[i] < 0) return false;
+		}
+
+		return true;
+	}
+};
+
+#pragma mark - BVH
+
+// bounding volume hierarchy over world space boxes. moved items refit their leaf
+// and its ancestors, the tree keeps its shape until the next build()
+class BVH
+{
+public:
+
+	enum { LEAF_SIZE = 4, MAX_DEPTH = 64 };
+
+	BVH() : depth(0) {}
+
+	void build(const vector<BoundingBox>& boxes)
+	{
+		nodes.clear();
+		parents.clear();
+		this->boxes = boxes;
+		items.resize(boxes.size());
+		item_leaf.resize(boxes.size());
+		centers.resize(boxes.size());
+		depth = 0;
+
+		for (size_t i = 0; i < boxes.size(); i++)
+		{
+			items[i] = i;
+			centers[i] = boxes[i].getCenter();
+		}
+
+		if (boxes.empty()) return;
+
+		nodes.reserve(boxes.size() * 2 / LEAF_SIZE + 1);
+		nodes.push_back(Branch());
+		parents.push_back(0);
+		buildNode(0, 0, items.size(), 1);
+
+		// a median split halves the items, so the depth is log2(n / LEAF_SIZE)
+		assert(depth < MAX_DEPTH);
+	}
+
+	void clear()
+	{
+		nodes.clear();
+		parents.clear();
+		boxes.clear();
+		items.clear();
+		item_leaf.clear();
+		centers.clear();
+		depth = 0;
+	}
+
+	// the parents are only grown or shrunk up to the first one that keeps its bounds
+	void refit(size_t item, const BoundingBox& box)
+	{
+		boxes[item] = box;
+
+		size_t index = item_leaf[item];
+
+		while (true)
+		{
+			const Branch &n = nodes[index];
+			BoundingBox bounds;
+
+			if (n.count > 0)
+			{
+				for (size_t i = n.first; i < n.first + n.count; i++)
+					bounds.add(boxes[items[i]]);
+			}
+			else
+			{
+				bounds.add(nodes[n.first].bounds);
+				bounds.add(nodes[n.first + 1].bounds);
+			}
+
+			if (bounds == n.bounds) break;
+			nodes[index].bounds = bounds;
+
+			if (index == 0) break;
+			index = parents[index];
+		}
+	}
+
+	template <typename Volume>
+	void query(const Volume& volume, vector<size_t>& result) const
+	{
+		if (nodes.empty()) return;
+
+		// a branch is popped before its two children are pushed
+		size_t stack[MAX_DEPTH + 1];
+		int sp = 0;
+		stack[sp++] = 0;
+
+		while (sp > 0)
+		{
+			const Branch &n = nodes[stack[--sp]];
+			if (!volume.intersects(n.bounds)) continue;
+
+			if (n.count > 0)
+			{
+				result.insert(result.end(), items.begin() + n.first, items.begin() + n.first + n.count);
+			}
+			else
+			{
+				stack[sp++] = n.first;
+				stack[sp++] = n.first + 1;
+			}
+		}
+	}
+
+	size_t size() const { return items.size(); }
+	int getDepth() const { return depth; }
+
+protected:
+
+	struct Branch
+	{
+		BoundingBox bounds;
+
+		// leaf: range of items, inner: index of the left child (right is next to it)
+		size_t first, count;
+	};
+
+	vector<Branch> nodes;
+	vector<size_t> parents;
+
+	vector<BoundingBox> boxes;
+	vector<size_t> items, item_leaf;
+	vector<ofVec3f> centers;
+
+	int depth;
+
+	struct CenterLess
+	{
+		const vector<ofVec3f> &centers;
+		int axis;
+
+		CenterLess(const vector<ofVec3f> &centers, int axis) : centers(centers), axis(axis) {}
+		bool operator()(size_t a, size_t b) const { return centers[a][axis] < centers[b][axis]; }
+	};
+
+	void buildNode(size_t index, size_t first, size_t count, int level)
+	{
+		depth = max(depth, level);
+
+		BoundingBox bounds, center_bounds;
+		for (size_t i = first; i < first + count; i++)
+		{
+			bounds.add(boxes[items[i]]);
+			center_bounds.add(centers[items[i]]);
+		}
+
+		nodes[index].bounds = bounds;
+
+		if (count <= LEAF_SIZE)
+		{
+			nodes[index].first = first;
+			nodes[index].count = count;
+
+			for (size_t i = first; i < first + count; i++)
+				item_leaf[items[i]] = index;
+
+			return;
+		}
+
+		const ofVec3f extent = center_bounds.getSize();
+		int axis = 0;
+		if (extent.y > extent[axis]) axis = 1;
+		if (extent.z > extent[axis]) axis = 2;
+
+		const size_t half = count / 2;
+		nth_element(items.begin() + first, items.begin() + first + half,
+					items.begin() + first + count, CenterLess(centers, axis));
+
+		const size_t left = nodes.size();
+		nodes.push_back(Branch());
+		nodes.push_back(Branch());
+		parents.push_back(index);
+		parents.push_back(index);
+
+		nodes[index].first = left;
+		nodes[index].count = 0;
+
+		buildNode(left, first, half, level + 1);
+		buildNode(left + 1, first + half, count - half, level + 1);
+	}
+};
+
+#pragma mark - Grid
+
+// uniform grid over screen space rectangles (2D overlays). the cells are hashed
+// into a flat table of buckets, items from other cells in a bucket are told apart
+// by their rects. items covering too many cells are kept in a separate list
+class Grid
+{
+public:
+
+	Grid() : bucket_mask(0), stamp(0), cell_size(64), max_cells_per_item(64), cell_min_x(0), cell_min_y(0), cell_max_x(-1), cell_max_y(-1) {}
+
+	void setCellSize(float v) { cell_size = v; }
+	float getCellSize() const { return cell_size; }
+
+	void build(const vector<ofRectangle>& rects)
+	{
+		this->rects = rects;
+		ranges.resize(rects.size());
+		large_items.clear();
+		stamps.assign(rects.size(), 0);
+		stamp = 0;
+
+		cell_min_x = cell_min_y = numeric_limits<int>::max();
+		cell_max_x = cell_max_y = numeric_limits<int>::min();
+
+		size_t num_entries = 0;
+		for (size_t i = 0; i < rects.size(); i++)
+		{
+			ranges[i] = getCellRange(rects[i]);
+			if (!isLarge(ranges[i])) num_entries += ranges[i].getNumCells();
+		}
+
+		// about two buckets per entry
+		size_t num_buckets = 64;
+		while (num_buckets < num_entries * 2) num_buckets <<= 1;
+
+		buckets.resize(num_buckets);
+		for (size_t i = 0; i < buckets.size(); i++)
+			buckets[i].clear();
+
+		bucket_mask = num_buckets - 1;
+
+		for (size_t i = 0; i < rects.size(); i++)
+			insert(i);
+	}
+
+	void clear()
+	{
+		buckets.clear();
+		rects.clear();
+		ranges.clear();
+		large_items.clear();
+		stamps.clear();
+	}
+
+	// only the buckets of the cells the item left or entered change
+	void move(size_t item, const ofRectangle& rect)
+	{
+		rects[item] = rect;
+
+		const CellRange range = getCellRange(rect);
+		if (range == ranges[item]) return;
+
+		remove(item);
+		ranges[item] = range;
+		insert(item);
+	}
+
+	void query(const ofRectangle& rect, vector<size_t>& result)
+	{
+		// stamps avoid reporting an item once per overlapped cell
+		if (++stamp == 0)
+		{
+			stamps.assign(stamps.size(), 0);
+			stamp = 1;
+		}
+
+		for (size_t i = 0; i < large_items.size(); i++)
+		{
+			if (overlaps(rects[large_items[i]], rect))
+				result.push_back(large_items[i]);
+		}
+
+		CellRange range = getCellRange(rect);
+
+		// only the populated area
+		range.x0 = max(range.x0, cell_min_x);
+		range.y0 = max(range.y0, cell_min_y);
+		range.x1 = min(range.x1, cell_max_x);
+		range.y1 = min(range.y1, cell_max_y);
+
+		for (int y = range.y0; y <= range.y1; y++)
+		{
+			for (int x = range.x0; x <= range.x1; x++)
+			{
+				const vector<size_t> &items = buckets[getBucket(x, y)];
+
+				for (size_t i = 0; i < items.size(); i++)
+				{
+					const size_t item = items[i];
+					if (stamps[item] == stamp) continue;
+
+					stamps[item] = stamp;
+					if (overlaps(rects[item], rect)) result.push_back(item);
+				}
+			}
+		}
+	}
+
+protected:
+
+	struct CellRange
+	{
+		int x0, y0, x1, y1;
+
+		long long getNumCells() const { return (long long)(x1 - x0 + 1) * (y1 - y0 + 1); }
+
+		bool operator==(const CellRange& o) const
+		{
+			return x0 == o.x0 && y0 == o.y0 && x1 == o.x1 && y1 == o.y1;
+		}
+	};
+
+	vector<vector<size_t> > buckets;
+	size_t bucket_mask;
+
+	vector<ofRectangle> rects;
+	vector<CellRange> ranges;
+	vector<size_t> large_items;
+
+	vector<unsigned int> stamps;
+	unsigned int stamp;
+
+	float cell_size;
+	int max_cells_per_item;
+
+	// grows with the inserted items, moves away do not shrink it
+	int cell_min_x, cell_min_y, cell_max_x, cell_max_y;
+
+	inline bool isLarge(const CellRange& r) const { return r.getNumCells() > max_cells_per_item; }
+
+	void insert(size_t item)
+	{
+		const CellRange &r = ranges[item];
+
+		if (isLarge(r))
+		{
+			large_items.push_back(item);
+			return;
+		}
+
+		cell_min_x = min(cell_min_x, r.x0);
+		cell_min_y = min(cell_min_y, r.y0);
+		cell_max_x = max(cell_max_x, r.x1);
+		cell_max_y = max(cell_max_y, r.y1);
+
+		for (int y = r.y0; y <= r.y1; y++)
+			for (int x = r.x0; x <= r.x1; x++)
+				buckets[getBucket(x, y)].push_back(item);
+	}
+
+	// cells sharing a bucket may hold the item more than once, one is taken per cell
+	void remove(size_t item)
+	{
+		const CellRange &r = ranges[item];
+
+		if (isLarge(r))
+		{
+			large_items.erase(find(large_items.begin(), large_items.end(), item));
+			return;
+		}
+
+		for (int y = r.y0; y <= r.y1; y++)
+		{
+			for (int x = r.x0; x <= r.x1; x++)
+			{
+				vector<size_t> &items = buckets[getBucket(x, y)];
+
+				vector<size_t>::iterator it = find(items.begin(), items.end(), item);
+				*it = items.back();
+				items.pop_back();
+			}
+		}
+	}
+
+	inline size_t getBucket(int x, int y) const
+	{
+		return ((unsigned int)x * 73856093u ^ (unsigned int)y * 19349663u) & bucket_mask;
+	}
+
+	// touching counts, like the cells
+	static inline bool overlaps(const ofRectangle& a, const ofRectangle& b)
+	{
+		return a.getMinX() <= b.getMaxX() && b.getMinX() <= a.getMaxX()
+			&& a.getMinY() <= b.getMaxY() && b.getMinY() <= a.getMaxY();
+	}
+
+	inline int toCell(float v) const
+	{
+		return ofClamp(floor(v / cell_size), -(1 << 24), 1 << 24);
+	}
+
+	inline CellRange getCellRange(const ofRectangle& r) const
+	{
+		CellRange c;
+		c.x0 = toCell(r.getMinX());
+		c.y0 = toCell(r.getMinY());
+		c.x1 = toCell(r.getMaxX());
+		c.y1 = toCell(r.getMaxY());
+		return c;
+	}
+};
+
+OFX_INTERACTIVE_PRIMITIVES_END_NAMESPACE
@@ -0,0 +1,208 @@
+#pragma once
+
+#include "ofMain.h"
+
+#include "ofxIPGLStateCache.h"
+
+#include <mutex>
+
+OFX_INTERACTIVE_PRIMITIVES_START_NAMESPACE
+
+#pragma mark - TextLayout
+
+// the glyph quads of a bitmap font string, laid out once per text in pixels
+// around its anchor. y points down, like ofDrawBitmapString with a flipped view
+class TextLayout
+{
+public:
+
+	// lays the text out again only when it changed. may run on update threads
+	void setText(const string& s)
+	{
+		if (s == text) return;
+
+		text = s;
+		vertices.clear();
+		tex_coords.clear();
+
+		if (text.empty()) return;
+
+		// the font reuses one mesh for every call
+		static std::mutex mutex;
+		std::lock_guard<std::mutex> lock(mutex);
+
+		const ofMesh &mesh = getFont().getMesh(text, 0, 0, OF_BITMAPMODE_MODEL_BILLBOARD, true);
+
+		if (mesh.hasIndices())
+		{
+			for (size_t i = 0; i < mesh.getNumIndices(); i++)
+			{
+				const ofIndexType k = mesh.getIndex(i);
+				vertices.push_back(mesh.getVertex(k));
+				tex_coords.push_back(mesh.getTexCoord(k));
+			}
+		}
+		else
+		{
+			vertices = mesh.getVertices();
+			tex_coords = mesh.getTexCoords();
+		}
+	}
+
+	const string& getText() const { return text; }
+
+	bool empty() const { return vertices.empty(); }
+
+	// triangles, three vertices each
+	const vector<ofVec3f>& getVertices() const { return vertices; }
+	const vector<ofVec2f>& getTexCoords() const { return tex_coords; }
+
+	// like ofDrawBitmapString(text, x, y) with the current color, without laying the text out.
+	// inside RootNode::draw() it goes to the batch of the root, see PrimitiveBatch::getCurrent()
+	void draw(float x, float y) const;
+
+	// the glyph texture is shared by every layout
+	static const ofBitmapFont& getFont()
+	{
+		static ofBitmapFont font;
+		return font;
+	}
+
+protected:
+
+	string text;
+
+	vector<ofVec3f> vertices;
+	vector<ofVec2f> tex_coords;
+};
+
+#pragma mark - TextBatch
+
+// draws many layouts with one call. each layout is anchored at the projection of
+// a point, and drawn in window pixels like OF_BITMAPMODE_MODEL_BILLBOARD
+class TextBatch
+{
+public:
+
+	TextBatch() : viewport_width(0), viewport_height(0), vbo_dirty(true)
+	{
+		mesh.setMode(OF_PRIMITIVE_TRIANGLES);
+	}
+
+	// anchors are transformed by modelview_projection into the viewport
+	void begin(const ofMatrix4x4& modelview_projection, const ofRectangle& viewport)
+	{
+		mvp = modelview_projection;
+		viewport_width = viewport.width;
+		viewport_height = viewport.height;
+
+		clear();
+	}
+
+	// with the current matrices and viewport
+	void begin()
+	{
+		if (ofIsGLProgrammableRenderer())
+		{
+			begin(ofGetCurrentMatrix(OF_MATRIX_MODELVIEW) * ofGetCurrentMatrix(OF_MATRIX_PROJECTION), ofGetNativeViewport());
+			return;
+		}
+		
+		GLfloat m[16], p[16];
+		GLint v[4];
+
+		glGetFloatv(GL_MODELVIEW_MATRIX, m);
+		glGetFloatv(GL_PROJECTION_MATRIX, p);
+		glGetIntegerv(GL_VIEWPORT, v);
+
+		begin(ofMatrix4x4(m) * ofMatrix4x4(p), ofRectangle(v[0], v[1], v[2], v[3]));
+	}
+
+	// skipped when the anchor is behind the camera or beyond the far plane
+	void add(const TextLayout& layout, const ofVec3f& anchor, const ofColor& color)
+	{
+		if (layout.empty()) return;
+
+		const ofVec4f clip = mvp.preMult(ofVec4f(anchor.x, anchor.y, anchor.z, 1));
+		if (clip.w <= 0 || clip.z >= clip.w) return;
+
+		const float x = (clip.x / clip.w + 1) * 0.5 * viewport_width;
+		const float y = (1 - clip.y / clip.w) * 0.5 * viewport_height;
+
+		const vector<ofVec3f> &v = layout.getVertices();
+		const vector<ofVec2f> &t = layout.getTexCoords();
+		const ofFloatColor c(color);
+
+		vbo_dirty = true;
+
+		for (size_t i = 0; i < v.size(); i++)
+		{
+			mesh.addVertex(ofVec3f(v[i].x + x, v[i].y + y, 0));
+			mesh.addTexCoord(t[i]);
+			mesh.addColor(c);
+		}
+	}
+
+	bool empty() const { return mesh.getNumVertices() == 0; }
+
+	size_t getNumVertices() const { return mesh.getNumVertices(); }
+	size_t getNumGlyphs() const { return mesh.getNumVertices() / 6; }
+
+	// the vertices from..to of another batch with the same view
+	void append(const TextBatch& src, size_t from, size_t to)
+	{
+		if (to <= from) return;
+
+		vbo_dirty = true;
+		mesh.addVertices(&src.mesh.getVertices()[from], to - from);
+		mesh.addTexCoords(&src.mesh.getTexCoords()[from], to - from);
+		mesh.addColors(&src.mesh.getColors()[from], to - from);
+	}
+
+	// one draw call in window pixels, the matrices are restored
+	void draw() { draw(0, getNumVertices()); }
+
+	// the vertices from..to, the rest stays uploaded for the next range
+	void draw(size_t from, size_t to)
+	{
+		if (to <= from) return;
+
+		if (vbo_dirty)
+		{
+			vbo.setMesh(mesh, GL_STREAM_DRAW);
+			vbo_dirty = false;
+		}
+
+		GLStateCache &gl_state = GLStateCache::get();
+		gl_state.pushMatrices(ofMatrix4x4::newOrthoMatrix(0, viewport_width, viewport_height, 0, -1, 1), ofMatrix4x4());
+		gl_state.begin();
+		gl_state.setDepthTest(false);
+		gl_state.setBlendMode(OF_BLENDMODE_ALPHA);
+
+		const ofTexture &texture = TextLayout::getFont().getTexture();
+		texture.bind();
+		vbo.draw(GL_TRIANGLES, from, to - from);
+		texture.unbind();
+
+		gl_state.invalidateColor();
+		gl_state.end();
+		gl_state.popMatrices();
+	}
+
+	void clear()
+	{
+		mesh.clear();
+		vbo_dirty = true;
+	}
+
+protected:
+
+	ofMatrix4x4 mvp;
+	float viewport_width, viewport_height;
+
+	ofMesh mesh;
+	ofVbo vbo;
+	bool vbo_dirty;
+};
+
+OFX_INTERACTIVE_PRIMITIVES_END_NAMESPACE
@@ -0,0 +1,210 @@
+#pragma once
+
+#include "ofMain.h"
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+OFX_INTERACTIVE_PRIMITIVES_START_NAMESPACE
+
+#pragma mark - WorkStealingPool
+
+// runs tasks on a fixed set of threads. each thread owns a queue, takes its newest
+// task first (depth first) and steals the oldest task of another queue when idle.
+// the thread calling run() is worker 0 and works until every task is done
+template <typename Task>
+class WorkStealingPool
+{
+public:
+
+	// may push() more tasks to the queue of the worker it runs on
+	typedef void (*Handler)(void *user, const Task &task, int worker);
+
+	WorkStealingPool() : handler(NULL), user(NULL), pending(0), generation(0), finished(0), quit(false)
+	{
+		setNumThreads(1);
+	}
+
+	~WorkStealingPool()
+	{
+		stopThreads();
+		clearQueues();
+	}
+
+	// including the thread calling run(), 0 uses every hardware thread
+	void setNumThreads(int n)
+	{
+		if (n <= 0) n = max<int>(std::thread::hardware_concurrency(), 1);
+		if (n == getNumThreads()) return;
+
+		stopThreads();
+		clearQueues();
+
+		for (int i = 0; i < n; i++)
+			queues.push_back(new Queue);
+
+		quit = false;
+		generation = 0;
+
+		for (int i = 1; i < n; i++)
+			threads.push_back(new std::thread(&WorkStealingPool::threadMain, this, i));
+	}
+
+	int getNumThreads() const { return queues.size(); }
+
+	void push(int worker, const Task &task)
+	{
+		pending++;
+
+		Queue &q = *queues[worker];
+		std::lock_guard<std::mutex> lock(q.mutex);
+		q.tasks.push_back(task);
+	}
+
+	// returns when all tasks, including the ones pushed while running, are done
+	void run(Handler h, void *u)
+	{
+		if (pending == 0) return;
+
+		handler = h;
+		user = u;
+
+		{
+			std::lock_guard<std::mutex> lock(wake_mutex);
+			generation++;
+			finished = 0;
+		}
+		wake.notify_all();
+
+		work(0);
+
+		// no worker may still hold the handler when the caller moves on
+		std::unique_lock<std::mutex> lock(wake_mutex);
+		while (finished < (int)threads.size())
+			done.wait(lock);
+	}
+
+protected:
+
+	struct Queue
+	{
+		std::mutex mutex;
+		deque<Task> tasks;
+	};
+
+	vector<Queue*> queues;
+	vector<std::thread*> threads;
+
+	Handler handler;
+	void *user;
+
+	std::atomic<int> pending;
+
+	std::mutex wake_mutex;
+	std::condition_variable wake, done;
+	unsigned int generation;
+	int finished;
+	bool quit;
+
+	void threadMain(int worker)
+	{
+		unsigned int seen = 0;
+
+		while (true)
+		{
+			{
+				std::unique_lock<std::mutex> lock(wake_mutex);
+				while (!quit && generation == seen)
+					wake.wait(lock);
+
+				if (quit) return;
+				seen = generation;
+			}
+
+			work(worker);
+
+			{
+				std::lock_guard<std::mutex> lock(wake_mutex);
+				finished++;
+			}
+			done.notify_one();
+		}
+	}
+
+	void work(int worker)
+	{
+		Task task;
+
+		while (pending > 0)
+		{
+			if (pop(worker, task) || steal(worker, task))
+			{
+				handler(user, task, worker);
+
+				// after the handler, so tasks it pushed keep the count above zero
+				pending--;
+			}
+			else std::this_thread::yield();
+		}
+	}
+
+	bool pop(int worker, Task &task)
+	{
+		Queue &q = *queues[worker];
+		std::lock_guard<std::mutex> lock(q.mutex);
+
+		if (q.tasks.empty()) return false;
+
+		task = q.tasks.back();
+		q.tasks.pop_back();
+		return true;
+	}
+
+	bool steal(int worker, Task &task)
+	{
+		const int n = queues.size();
+
+		for (int i = 1; i < n; i++)
+		{
+			Queue &q = *queues[(worker + i) % n];
+			std::lock_guard<std::mutex> lock(q.mutex);
+
+			if (q.tasks.empty()) continue;
+
+			task = q.tasks.front();
+			q.tasks.pop_front();
+			return true;
+		}
+
+		return false;
+	}
+
+	void stopThreads()
+	{
+		{
+			std::lock_guard<std::mutex> lock(wake_mutex);
+			quit = true;
+		}
+		wake.notify_all();
+
+		for (size_t i = 0; i < threads.size(); i++)
+		{
+			threads[i]->join();
+			delete threads[i];
+		}
+
+		threads.clear();
+	}
+
+	void clearQueues()
+	{
+		for (size_t i = 0; i < queues.size(); i++)
+			delete queues[i];
+
+		queues.clear();
+	}
+};
+
+OFX_INTERACTIVE_PRIMITIVES_END_NAMESPACE
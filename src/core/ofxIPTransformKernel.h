@@ -0,0 +1,268 @@
+#pragma once
+
+#include "ofMain.h"
+
+// define OFX_INTERACTIVE_PRIMITIVES_NO_SIMD to force the scalar kernel
+#if !defined(OFX_INTERACTIVE_PRIMITIVES_NO_SIMD)
+#	if defined(__AVX__)
+#		define OFX_INTERACTIVE_PRIMITIVES_USE_AVX
+#		include <immintrin.h>
+#	elif defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#		define OFX_INTERACTIVE_PRIMITIVES_USE_SSE
+#		include <xmmintrin.h>
+#	endif
+#endif
+
+OFX_INTERACTIVE_PRIMITIVES_START_NAMESPACE
+
+#pragma mark - lanes
+
+// the kernel is written once against these, one float per lane
+namespace TransformLanes
+{
+	struct Scalar
+	{
+		enum { WIDTH = 1 };
+
+		float v;
+
+		Scalar() {}
+		Scalar(float v) : v(v) {}
+
+		static Scalar load(const float *p) { return Scalar(*p); }
+		void store(float *p) const { *p = v; }
+
+		// a where x is zero, otherwise b
+		static Scalar selectZero(const Scalar& x, const Scalar& a, const Scalar& b) { return x.v == 0 ? a : b; }
+
+		friend Scalar operator+(const Scalar& a, const Scalar& b) { return a.v + b.v; }
+		friend Scalar operator-(const Scalar& a, const Scalar& b) { return a.v - b.v; }
+		friend Scalar operator*(const Scalar& a, const Scalar& b) { return a.v * b.v; }
+		friend Scalar operator/(const Scalar& a, const Scalar& b) { return a.v / b.v; }
+	};
+
+#ifdef OFX_INTERACTIVE_PRIMITIVES_USE_SSE
+	struct SSE
+	{
+		enum { WIDTH = 4 };
+
+		__m128 v;
+
+		SSE() {}
+		SSE(__m128 v) : v(v) {}
+		SSE(float s) : v(_mm_set1_ps(s)) {}
+
+		static SSE load(const float *p) { return _mm_loadu_ps(p); }
+		void store(float *p) const { _mm_storeu_ps(p, v); }
+
+		static SSE selectZero(const SSE& x, const SSE& a, const SSE& b)
+		{
+			const __m128 mask = _mm_cmpeq_ps(x.v, _mm_setzero_ps());
+			return _mm_or_ps(_mm_and_ps(mask, a.v), _mm_andnot_ps(mask, b.v));
+		}
+
+		friend SSE operator+(const SSE& a, const SSE& b) { return _mm_add_ps(a.v, b.v); }
+		friend SSE operator-(const SSE& a, const SSE& b) { return _mm_sub_ps(a.v, b.v); }
+		friend SSE operator*(const SSE& a, const SSE& b) { return _mm_mul_ps(a.v, b.v); }
+		friend SSE operator/(const SSE& a, const SSE& b) { return _mm_div_ps(a.v, b.v); }
+	};
+#endif
+
+#ifdef OFX_INTERACTIVE_PRIMITIVES_USE_AVX
+	struct AVX
+	{
+		enum { WIDTH = 8 };
+
+		__m256 v;
+
+		AVX() {}
+		AVX(__m256 v) : v(v) {}
+		AVX(float s) : v(_mm256_set1_ps(s)) {}
+
+		static AVX load(const float *p) { return _mm256_loadu_ps(p); }
+		void store(float *p) const { _mm256_storeu_ps(p, v); }
+
+		static AVX selectZero(const AVX& x, const AVX& a, const AVX& b)
+		{
+			const __m256 mask = _mm256_cmp_ps(x.v, _mm256_setzero_ps(), _CMP_EQ_OQ);
+			return _mm256_blendv_ps(b.v, a.v, mask);
+		}
+
+		friend AVX operator+(const AVX& a, const AVX& b) { return _mm256_add_ps(a.v, b.v); }
+		friend AVX operator-(const AVX& a, const AVX& b) { return _mm256_sub_ps(a.v, b.v); }
+		friend AVX operator*(const AVX& a, const AVX& b) { return _mm256_mul_ps(a.v, b.v); }
+		friend AVX operator/(const AVX& a, const AVX& b) { return _mm256_div_ps(a.v, b.v); }
+	};
+#endif
+}
+
+#pragma mark - TransformKernel
+
+// composes local * parent and inverts the result for a batch of affine matrices.
+// matrices are kept as structure of arrays, 3x3 linear part row by row then
+// the translation row (ofMatrix4x4 multiplies row vectors)
+class TransformKernel
+{
+public:
+
+	enum { NUM_COMPONENTS = 12 };
+	
+	// batches of this size stay in the L1 cache, run() and get() them once full()
+	enum { BATCH_SIZE = 256 };
+
+	TransformKernel() : count(0), capacity(0) {}
+
+	void clear() { count = 0; }
+	size_t size() const { return count; }
+	bool empty() const { return count == 0; }
+	bool full() const { return count >= BATCH_SIZE; }
+
+	// returns the index of the result
+	size_t add(const ofMatrix4x4& parent_global, const ofMatrix4x4& local)
+	{
+		if (count == capacity) grow();
+
+		const float *p = parent_global.getPtr();
+		const float *l = local.getPtr();
+
+		for (int c = 0; c < NUM_COMPONENTS; c++)
+		{
+			const int k = (c / 3) * 4 + c % 3;
+			parent[c][count] = p[k];
+			this->local[c][count] = l[k];
+		}
+
+		return count++;
+	}
+
+	void run()
+	{
+		size_t i = 0;
+
+#if defined(OFX_INTERACTIVE_PRIMITIVES_USE_AVX)
+		i = runLanes<TransformLanes::AVX>(i);
+#elif defined(OFX_INTERACTIVE_PRIMITIVES_USE_SSE)
+		i = runLanes<TransformLanes::SSE>(i);
+#endif
+
+		runLanes<TransformLanes::Scalar>(i);
+	}
+
+	// singular matrices get an identity inverse like ofMatrix4x4::getInverse()
+	void get(size_t index, ofMatrix4x4& global, ofMatrix4x4& inverse) const
+	{
+		global = toMatrix(this->global, index);
+		inverse = toMatrix(this->inverse, index);
+	}
+
+	static const char* getInstructionSet()
+	{
+#if defined(OFX_INTERACTIVE_PRIMITIVES_USE_AVX)
+		return "AVX";
+#elif defined(OFX_INTERACTIVE_PRIMITIVES_USE_SSE)
+		return "SSE";
+#else
+		return "scalar";
+#endif
+	}
+
+protected:
+
+	size_t count, capacity;
+
+	vector<float> parent[NUM_COMPONENTS], local[NUM_COMPONENTS];
+	vector<float> global[NUM_COMPONENTS], inverse[NUM_COMPONENTS];
+
+	void grow()
+	{
+		capacity = max<size_t>(capacity * 2, 64);
+
+		for (int c = 0; c < NUM_COMPONENTS; c++)
+		{
+			parent[c].resize(capacity);
+			local[c].resize(capacity);
+			global[c].resize(capacity);
+			inverse[c].resize(capacity);
+		}
+	}
+
+	static ofMatrix4x4 toMatrix(const vector<float> *m, size_t i)
+	{
+		return ofMatrix4x4(m[0][i], m[1][i], m[2][i], 0,
+						   m[3][i], m[4][i], m[5][i], 0,
+						   m[6][i], m[7][i], m[8][i], 0,
+						   m[9][i], m[10][i], m[11][i], 1);
+	}
+
+	// processes whole lanes from first on, returns the first index left over
+	template <typename V>
+	size_t runLanes(size_t first)
+	{
+		size_t i = first;
+
+		for (; i + V::WIDTH <= count; i += V::WIDTH)
+		{
+			V P[NUM_COMPONENTS], L[NUM_COMPONENTS], G[NUM_COMPONENTS];
+
+			for (int c = 0; c < NUM_COMPONENTS; c++)
+			{
+				P[c] = V::load(&parent[c][i]);
+				L[c] = V::load(&local[c][i]);
+			}
+
+			// global = local * parent
+			for (int r = 0; r < 4; r++)
+			{
+				for (int k = 0; k < 3; k++)
+				{
+					V v = L[r * 3] * P[k] + L[r * 3 + 1] * P[3 + k] + L[r * 3 + 2] * P[6 + k];
+					if (r == 3) v = v + P[9 + k];
+					G[r * 3 + k] = v;
+				}
+			}
+
+			for (int c = 0; c < NUM_COMPONENTS; c++)
+				G[c].store(&global[c][i]);
+
+			// inverse of the 3x3 part from its cofactors
+			const V &a = G[0], &b = G[1], &c = G[2];
+			const V &d = G[3], &e = G[4], &f = G[5];
+			const V &g = G[6], &h = G[7], &k = G[8];
+
+			V I[NUM_COMPONENTS];
+			I[0] = e * k - f * h;
+			I[1] = c * h - b * k;
+			I[2] = b * f - c * e;
+			I[3] = f * g - d * k;
+			I[4] = a * k - c * g;
+			I[5] = c * d - a * f;
+			I[6] = d * h - e * g;
+			I[7] = b * g - a * h;
+			I[8] = a * e - b * d;
+
+			const V det = a * I[0] + b * I[3] + c * I[6];
+			const V one(1.f), zero(0.f);
+			const V inv_det = one / V::selectZero(det, one, det);
+
+			for (int n = 0; n < 9; n++)
+			{
+				const V identity((n % 4) == 0 ? 1.f : 0.f);
+				I[n] = V::selectZero(det, identity, I[n] * inv_det);
+			}
+
+			// translation of the inverse, -t * inverse(A)
+			for (int n = 0; n < 3; n++)
+			{
+				const V t = G[9] * I[n] + G[10] * I[3 + n] + G[11] * I[6 + n];
+				I[9 + n] = V::selectZero(det, zero, zero - t);
+			}
+
+			for (int n = 0; n < NUM_COMPONENTS; n++)
+				I[n].store(&inverse[n][i]);
+		}
+
+		return i;
+	}
+};
+
+OFX_INTERACTIVE_PRIMITIVES_END_NAMESPACE
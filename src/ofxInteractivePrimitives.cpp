@@ -6,49 +6,248 @@ class Context
 {
 public:
 
-	typedef map<unsigned int, Node*> ElemetsContainer;
-	ElemetsContainer elements;
+	// hot node data and the id registry, the root owns a slot too
+	SceneArena arena;
+	Node *root;
 
 	GLint viewport[4];
 	GLdouble projection[16], modelview[16];
 
+	ofMatrix4x4 modelViewMatrix, projectionMatrix;
 	ofMatrix4x4 modelViewProjectionMatrix;
 	ofMatrix4x4 modelViewProjectionMatrixInverse;
+	
+	// ofGLProgrammableRenderer: no fixed function calls, the matrices come from OF
+	bool programmable, renderer_checked;
 
-	unsigned int current_object_id;
-	float current_depth;
-
-	Node *current_object;
-	Node *focus_object;
+	NodeHandle focus_object;
+	
+	// the mouse is pointer 0
+	struct Pointer
+	{
+		NodeHandle current_object, hover_object;
+		vector<GLuint> name_stack;
+		float depth;
+		
+		Pointer() : depth(0) {}
+	};
+	
+	typedef map<int, Pointer> PointerContainer;
+	PointerContainer pointers;
 	
-	vector<GLuint> current_name_stack;
+	// the pointer being dispatched, the mouse otherwise
+	int current_pointer_id;
+	Pointer *current_pointer;
 	
 	float last_update_time;
+	
+	PickingMode picking_mode;
+	
+	enum { PICK_REGION_SIZE = 5 };
+	
+	SpatialIndexType spatial_index;
+	
+	// only structural changes rebuild the index, also set from parallel updates
+	std::atomic<bool> index_dirty;
+	
+	// the camera moved, the grid rects are projected again
+	bool index_reproject;
+	
+	BVH bvh;
+	Grid grid;
+	
+	// index items, and nodes without bounds which are always tested
+	vector<Node*> indexed_nodes, unbounded_nodes;
+	vector<size_t> index_query_result;
+	
+	// by slot, the item of the node in the index or -1
+	vector<int> index_items;
+	
+	// slots whose hit bounds changed outside the update walk
+	vector<int> bounds_pending;
+	
+	ofFbo color_id_fbo;
+	bool color_id_dirty;
+	
+	// name stacks by color id, 0 is the background
+	vector<vector<GLuint> > color_id_names;
+	map<vector<GLuint>, GLuint> color_id_lookup;
+	
+	bool input_coalescing;
+	bool flushing_input;
+	
+	enum PointerEventType { POINTER_PRESSED, POINTER_RELEASED, POINTER_MOVED, POINTER_DRAGGED };
+	
+	struct QueuedPointerEvent
+	{
+		PointerEventType type;
+		int pointer;
+		float x, y;
+		int button;
+	};
+	
+	vector<QueuedPointerEvent> input_queue;
+	InputStats input_stats;
+	
+	// bumped by any change that can move a hit shape, also from parallel updates
+	std::atomic<unsigned int> scene_version;
+	
+	// some global matrix of the arena is older than its node, also set from parallel updates
+	std::atomic<bool> transforms_dirty;
+	
+	// the update walk or the draw workers read the arena, its matrices are left alone
+	bool walking;
 
-	Context() : current_object_id(0), current_depth(0), focus_object(NULL), current_object(NULL)
+	Context() : root(NULL), programmable(false), renderer_checked(false), current_pointer_id(0), picking_mode(PICKING_GL_SELECT), spatial_index(SPATIAL_INDEX_NONE), index_dirty(true), index_reproject(false), color_id_dirty(true), input_coalescing(false), flushing_input(false), scene_version(0), transforms_dirty(true), walking(false), state_changes_base(0), culling(false), render_mode(RENDER_IMMEDIATE), parallel_draw(false), num_draw_chunks(0), draw_slots(NULL), parallel_update(false), updating_on_workers(false), culling_deferred(false), pick_memo(PICK_MEMO_SIZE), pick_cache_enabled(false), pick_cache(PICK_CACHE_SIZE), select_buffer(256)
 	{
+		current_pointer = &pointers[0];
+		
+		// zeros differ from any camera, so setView() sets every matrix
+		memset(viewport, 0, sizeof(viewport));
+		memset(projection, 0, sizeof(projection));
+		memset(modelview, 0, sizeof(modelview));
+		setView(ofMatrix4x4(), ofMatrix4x4(), ofRectangle());
 		enableAllEvent();
 	}
 
 	~Context()
 	{
+		clearDrawChunks();
 		disableAllEvent();
 	}
 
-	void registerElement(Node *o)
+	// without recursion, subtrees may be deep chains
+	vector<Node*> subtree_stack;
+	
+	// a subtree built outside the scene joins with it. false when the ids ran out,
+	// then nothing is allocated
+	bool registerElement(Node *o)
 	{
-		assert(o->object_id == 0);
+		size_t num_nodes = 0;
+		subtree_stack.assign(1, o);
+		
+		while (!subtree_stack.empty())
+		{
+			Node *e = subtree_stack.back();
+			subtree_stack.pop_back();
+			
+			subtree_stack.insert(subtree_stack.end(), e->children.begin(), e->children.end());
+			num_nodes++;
+		}
+		
+		if (num_nodes > arena.getNumFreeSlots())
+		{
+			ofLogError("ofxInteractivePrimitives") << "no ids left for " << num_nodes << " nodes, the subtree is not added";
+			return false;
+		}
+		
+		subtree_stack.assign(1, o);
+		
+		while (!subtree_stack.empty())
+		{
+			Node *e = subtree_stack.back();
+			subtree_stack.pop_back();
+			
+			assert(e->object_id == 0);
+			
+			e->registered_context = this;
+			e->slot = arena.allocate(e);
+			e->object_id = arena.getId(e->slot);
+			
+			// a released slot may come back during the update walk
+			if ((size_t)e->slot < walked.size()) walked[e->slot] = WALKED_NONE;
+			
+			arena.setFlag(e->slot, SceneArena::VISIBLE, e->visible);
+			arena.setFlag(e->slot, SceneArena::ENABLE, e->enable);
+			
+			// the children below o are linked in order
+			arena.link(e->slot, e->getParent()->slot, e == o ? getNextSiblingSlot(e) : SceneArena::NONE);
+			
+			// reversed, so siblings keep their order in the arena
+			for (size_t i = e->children.size(); i-- > 0; )
+				subtree_stack.push_back(e->children[i]);
+		}
+		
+		index_dirty = true;
+		transforms_dirty = true;
+		scene_version++;
 		
-		o->object_id = current_object_id++;
-		elements[o->object_id] = o;
+		return true;
 	}
 
+	// the whole subtree leaves the scene. handles to its nodes, including
+	// focus_object and the pointer captures, stop resolving
 	void unregisterElement(Node *o)
 	{
-		if (o == current_object) current_object = NULL;
-		if (o == focus_object) focus_object = NULL;
-
-		elements.erase(o->object_id);
+		subtree_stack.assign(1, o);
+		releaseSubtrees();
+	}
+	
+	// many subtrees in one pass, the index and the scene version are invalidated once
+	void unregisterElements(const vector<Node*> &nodes)
+	{
+		subtree_stack.assign(nodes.begin(), nodes.end());
+		releaseSubtrees();
+	}
+	
+	void releaseSubtrees()
+	{
+		while (!subtree_stack.empty())
+		{
+			Node *e = subtree_stack.back();
+			subtree_stack.pop_back();
+			
+			subtree_stack.insert(subtree_stack.end(), e->children.begin(), e->children.end());
+			
+			e->registered_context = NULL;
+			e->object_id = 0;
+			
+			// the pointer records no longer resolve it
+			e->num_hovers = 0;
+			
+			arena.release(e->slot);
+			e->slot = SceneArena::NONE;
+		}
+		
+		index_dirty = true;
+		scene_version++;
+	}
+	
+	// reparenting inside the context keeps the id, handles stay valid
+	void moveElement(Node *o)
+	{
+		arena.link(o->slot, o->getParent()->slot, getNextSiblingSlot(o));
+		
+		index_dirty = true;
+		transforms_dirty = true;
+		scene_version++;
+	}
+	
+	// o moved among its siblings, the bounds stay valid
+	void reorderElement(Node *o)
+	{
+		arena.moveBefore(o->slot, getNextSiblingSlot(o));
+		
+		color_id_dirty = true;
+		scene_version++;
+	}
+	
+	// the arena links follow the children of the nodes
+	int getNextSiblingSlot(Node *o)
+	{
+		const vector<Node*> &c = o->getParent()->children;
+		
+		vector<Node*>::const_iterator it = find(c.begin(), c.end(), o);
+		assert(it != c.end());
+		
+		return ++it != c.end() ? (*it)->slot : (int)SceneArena::NONE;
+	}
+	
+	// NULL for 0 and the ids of disposed nodes
+	inline Node* findElement(unsigned int id) const
+	{
+		const int s = arena.findSlot(id);
+		return s != SceneArena::NONE ? arena.node[s] : NULL;
 	}
 
 	void enableAllEvent()
@@ -72,336 +271,2440 @@ public:
 		ofRemoveListener(ofEvents().keyPressed, this, &Context::keyPressed);
 		ofRemoveListener(ofEvents().keyReleased, this, &Context::keyReleased);
 	}
-
-	void prepare()
+
+	void prepare()
+	{
+		checkRenderer();
+		
+		if (programmable)
+		{
+			setView(ofGetCurrentMatrix(OF_MATRIX_MODELVIEW), ofGetCurrentMatrix(OF_MATRIX_PROJECTION), ofGetNativeViewport());
+			return;
+		}
+		
+		GLdouble p[16], m[16];
+		GLint v[4];
+		
+		glGetDoublev(GL_PROJECTION_MATRIX, p);
+		glGetDoublev(GL_MODELVIEW_MATRIX, m);
+		glGetIntegerv(GL_VIEWPORT, v);
+		
+		setView(ofMatrix4x4(m), ofMatrix4x4(p), ofRectangle(v[0], v[1], v[2], v[3]));
+	}
+	
+	void setView(const ofMatrix4x4& m, const ofMatrix4x4& p, const ofRectangle& v)
+	{
+		GLdouble new_modelview[16], new_projection[16];
+		
+		for (int i = 0; i < 16; i++)
+		{
+			new_modelview[i] = m.getPtr()[i];
+			new_projection[i] = p.getPtr()[i];
+		}
+		
+		const bool changed = memcmp(new_modelview, modelview, sizeof(modelview)) != 0
+			|| memcmp(new_projection, projection, sizeof(projection)) != 0
+			|| viewport[0] != v.x || viewport[1] != v.y
+			|| viewport[2] != v.width || viewport[3] != v.height;
+		
+		if (!changed) return;
+		
+		memcpy(modelview, new_modelview, sizeof(modelview));
+		memcpy(projection, new_projection, sizeof(projection));
+		
+		viewport[0] = v.x;
+		viewport[1] = v.y;
+		viewport[2] = v.width;
+		viewport[3] = v.height;
+		
+		modelViewMatrix = m;
+		projectionMatrix = p;
+		modelViewProjectionMatrix = m * p;
+		modelViewProjectionMatrixInverse = modelViewProjectionMatrix.getInverse();
+		view_frustum = Frustum(modelViewProjectionMatrix);
+		
+		// screen space bounds move with the camera
+		if (spatial_index == SPATIAL_INDEX_GRID) index_reproject = true;
+		
+		color_id_dirty = true;
+		scene_version++;
+	}
+	
+	bool requiresGL() const { return picking_mode != PICKING_CPU; }
+	
+	void setPickingMode(PickingMode mode)
+	{
+		if (mode == PICKING_GL_SELECT && programmable)
+		{
+			ofLogNotice("ofxInteractivePrimitives") << "PICKING_GL_SELECT needs the fixed function pipeline, using PICKING_COLOR_ID";
+			mode = PICKING_COLOR_ID;
+		}
+		
+		picking_mode = mode;
+		color_id_dirty = true;
+		scene_version++;
+	}
+	
+	// GLStateCache changes counted from here to the end of draw()
+	unsigned int state_changes_base;
+	
+	void update()
+	{
+		last_update_time = ofGetElapsedTimef();
+		color_id_dirty = true;
+		culling_stats = CullingStats();
+		state_changes_base = GLStateCache::get().getNumChanges();
+		
+		// before the first GL pick, PICKING_CPU needs no renderer
+		if (requiresGL()) checkRenderer();
+	}
+	
+	// once, at the first update() picking with GL or the first draw(). the renderer
+	// may be created after the root
+	void checkRenderer()
+	{
+		if (renderer_checked) return;
+		
+		renderer_checked = true;
+		programmable = ofIsGLProgrammableRenderer();
+		if (programmable && picking_mode == PICKING_GL_SELECT) setPickingMode(picking_mode);
+	}
+	
+	float getLastUpdateTime() { return last_update_time; }
+	
+#pragma mark - transform
+	
+	// by slot, whether the global matrix changed this frame
+	vector<char> transform_changed;
+	
+	// changed slots by tree depth
+	vector<vector<int> > transform_levels;
+	
+	TransformKernel transform_kernel;
+	vector<int> transform_batch;
+	
+	// composes the global matrices of changed nodes one tree level at a time,
+	// so the parents of a batch are final before it runs
+	void propagateTransforms()
+	{
+		transforms_dirty = false;
+		
+		const vector<int> &order = arena.getOrder(root->slot);
+		transform_changed.assign(arena.node.size(), false);
+		
+		for (size_t i = 0; i < transform_levels.size(); i++)
+			transform_levels[i].clear();
+		
+		if (arena.hasFlag(root->slot, SceneArena::TRANSFORM_DIRTY))
+		{
+			updateTransform(root->slot);
+			transform_changed[root->slot] = true;
+		}
+		
+		size_t i = 1;
+		while (i < order.size())
+		{
+			const int s = order[i];
+			const bool parent_changed = transform_changed[arena.parent[s]];
+			
+			if (!arena.hasFlag(s, SceneArena::VISIBLE))
+			{
+				if (parent_changed) arena.setFlag(s, SceneArena::TRANSFORM_DIRTY, true);
+				i = arena.getSubtreeEnd(s);
+				continue;
+			}
+			
+			const bool dirty = arena.hasFlag(s, SceneArena::TRANSFORM_DIRTY);
+			if (dirty) arena.local[s] = arena.node[s]->getLocalTransformMatrix();
+			
+			if (parent_changed || dirty)
+			{
+				transform_changed[s] = true;
+				
+				const int depth = arena.depth[s];
+				if ((size_t)depth >= transform_levels.size()) transform_levels.resize(depth + 1);
+				transform_levels[depth].push_back(s);
+			}
+			
+			i++;
+		}
+		
+		for (size_t level = 1; level < transform_levels.size(); level++)
+		{
+			const vector<int> &slots = transform_levels[level];
+			
+			for (size_t k = 0; k < slots.size(); k++)
+			{
+				const int s = slots[k];
+				
+				transform_kernel.add(arena.global[arena.parent[s]], arena.local[s]);
+				transform_batch.push_back(s);
+				
+				if (transform_kernel.full()) runTransformBatch();
+			}
+			
+			runTransformBatch();
+		}
+	}
+	
+	// picks at event time and draw() see the nodes moved since the last walk.
+	// not while walking, the update walk keeps the matrices current itself
+	void ensureTransforms()
+	{
+		if (walking || !transforms_dirty) return;
+		propagateTransforms();
+	}
+	
+	// moves of nodes the update walk did not reach yet are left to it
+	void markTransformDirty(int s)
+	{
+		arena.setFlag(s, SceneArena::TRANSFORM_DIRTY, true);
+		
+		if (walking && !updating_on_workers && s != root->slot
+			&& (size_t)s < walked.size() && walked[s] == WALKED_NONE) return;
+		
+		transforms_dirty = true;
+	}
+	
+	// one node, for the root and nodes moved by their own update()
+	void updateTransform(int s)
+	{
+		Node *e = arena.node[s];
+		const int p = arena.parent[s];
+		
+		arena.local[s] = e->getLocalTransformMatrix();
+		
+		// the parent was updated first, so its global matrix is current
+		if (p != SceneArena::NONE)
+			arena.global[s] = arena.local[s] * arena.global[p];
+		else
+			arena.global[s] = e->getGlobalTransformMatrix();
+		
+		arena.global_inverse[s] = arena.global[s].getInverse();
+		arena.setFlag(s, SceneArena::TRANSFORM_DIRTY, false);
+		arena.setFlag(s, SceneArena::BOUNDS_DIRTY, true);
+		arena.setFlag(s, SceneArena::HIT_BOUNDS_DIRTY, true);
+	}
+	
+	void runTransformBatch()
+	{
+		if (transform_kernel.empty()) return;
+		
+		transform_kernel.run();
+		
+		for (size_t i = 0; i < transform_batch.size(); i++)
+		{
+			const int s = transform_batch[i];
+			transform_kernel.get(i, arena.global[s], arena.global_inverse[s]);
+			arena.setFlag(s, SceneArena::TRANSFORM_DIRTY, false);
+			arena.setFlag(s, SceneArena::BOUNDS_DIRTY, true);
+			markBoundsDirty(s);
+		}
+		
+		transform_kernel.clear();
+		transform_batch.clear();
+	}
+	
+#pragma mark - traversal
+	
+	vector<int> visible_slots;
+	
+	// depth first, without the root and hidden subtrees. with a frustum, also
+	// without the cullable subtrees outside it, their sizes are added to culled
+	const vector<int>& getVisibleSlots(const Frustum *frustum = NULL, unsigned int *culled = NULL)
+	{
+		const vector<int> &order = arena.getOrder(root->slot);
+		visible_slots.clear();
+		
+		for (size_t i = 1; i < order.size(); )
+		{
+			const int s = order[i];
+			
+			if (!arena.hasFlag(s, SceneArena::VISIBLE))
+			{
+				i = arena.getSubtreeEnd(s);
+				continue;
+			}
+			
+			if (frustum && arena.hasFlag(s, SceneArena::CULLABLE)
+				&& !frustum->intersects(arena.subtree_bounds[s]))
+			{
+				if (culled) *culled += arena.getSubtreeEnd(s) - i;
+				i = arena.getSubtreeEnd(s);
+				continue;
+			}
+			
+			visible_slots.push_back(s);
+			i++;
+		}
+		
+		return visible_slots;
+	}
+	
+#pragma mark - culling
+	
+	bool culling;
+	Frustum view_frustum;
+	CullingStats culling_stats;
+	
+	// world draw bounds of the nodes that moved or changed their local bounds,
+	// then the subtree bounds from the leaves up
+	void updateCullingBounds()
+	{
+		const vector<int> &slots = getVisibleSlots();
+		
+		for (size_t i = 0; i < slots.size(); i++)
+		{
+			const int s = slots[i];
+			
+			BoundingBox local;
+			const bool bounded = arena.node[s]->getLocalBounds(local);
+			
+			if (bounded != arena.hasFlag(s, SceneArena::HAS_DRAW_BOUNDS)
+				|| local != arena.local_draw_bounds[s]
+				|| arena.hasFlag(s, SceneArena::BOUNDS_DIRTY))
+			{
+				arena.local_draw_bounds[s] = local;
+				arena.draw_bounds[s] = local.transformed(arena.global[s]);
+				arena.setFlag(s, SceneArena::HAS_DRAW_BOUNDS, bounded);
+				arena.setFlag(s, SceneArena::BOUNDS_DIRTY, false);
+			}
+			
+			arena.subtree_bounds[s] = arena.draw_bounds[s];
+			arena.setFlag(s, SceneArena::CULLABLE, bounded);
+		}
+		
+		// children come after their parents
+		for (size_t i = slots.size(); i-- > 0; )
+		{
+			const int s = slots[i], p = arena.parent[s];
+			
+			if (arena.hasFlag(s, SceneArena::CULLABLE))
+				arena.subtree_bounds[p].add(arena.subtree_bounds[s]);
+			else
+				arena.setFlag(p, SceneArena::CULLABLE, false);
+		}
+	}
+	
+	// true when draw() can skip the subtree
+	bool cullDraw(int s)
+	{
+		if (!culling || !arena.hasFlag(s, SceneArena::CULLABLE)) return false;
+		if (view_frustum.intersects(arena.subtree_bounds[s])) return false;
+		
+		culling_stats.draw_culled += arena.getSubtreeEnd(s) - arena.getOrderIndex(s);
+		return true;
+	}
+	
+	// the sub frustum of a pick region in window coordinates
+	Frustum getPickFrustum(int x, int y, int w, int h)
+	{
+		const float x0 = (x - w * 0.5 - viewport[0]) / viewport[2] * 2 - 1;
+		const float y0 = (y - h * 0.5 - viewport[1]) / viewport[3] * 2 - 1;
+		const float x1 = (x + w * 0.5 - viewport[0]) / viewport[2] * 2 - 1;
+		const float y1 = (y + h * 0.5 - viewport[1]) / viewport[3] * 2 - 1;
+		
+		return Frustum(modelViewProjectionMatrix, x0, y0, x1, y1);
+	}
+	
+#pragma mark - batched draw
+	
+	RenderMode render_mode;
+	PrimitiveBatch batch;
+	RenderStats render_stats;
+	
+	// the visible nodes in depth first order, each with the global matrix of the arena.
+	// a node without drawBatched() flushes the batch and is drawn on top of it
+	void drawBatched()
+	{
+		// nodes may have moved in event handlers since update()
+		ensureTransforms();
+		
+		const vector<int> &slots = getVisibleSlots(culling ? &view_frustum : NULL, &culling_stats.draw_culled);
+		const ofRectangle view(viewport[0], viewport[1], viewport[2], viewport[3]);
+		
+		batch.begin(modelViewProjectionMatrix, view);
+		
+		if (parallel_draw && slots.size() > DRAW_CHUNK_SIZE)
+		{
+			recordParallel(slots, view);
+			submitChunks();
+		}
+		else
+		{
+			for (size_t i = 0; i < slots.size(); i++)
+			{
+				Node *e = arena.node[slots[i]];
+				
+				batch.setTransform(arena.global[e->slot]);
+				batch.resetStyle();
+				
+				if (e->drawBatched(batch))
+				{
+					render_stats.batched_nodes++;
+					continue;
+				}
+				
+				batch.flush();
+				drawImmediate(e);
+			}
+		}
+		
+		batch.end();
+		
+		render_stats.draw_calls = batch.getNumDrawCalls() + render_stats.immediate_nodes;
+	}
+	
+	void drawImmediate(Node *e)
+	{
+		pushTransformGL(e);
+		if (!e->setsOwnStyle()) GLStateCache::get().restoreStyle();
+		e->draw();
+		ofPopMatrix();
+		
+		render_stats.immediate_nodes++;
+	}
+	
+#pragma mark - parallel draw
+	
+	enum { DRAW_CHUNK_SIZE = 1024 };
+	
+	// the commands of a range of visible nodes: their primitives in world space,
+	// and the nodes left for draw() with how much of the batch comes before each
+	struct DrawChunk
+	{
+		size_t first, last;
+		
+		PrimitiveBatch batch;
+		vector<pair<Node*, PrimitiveBatch::Mark> > immediate;
+		unsigned int batched_nodes;
+	};
+	
+	bool parallel_draw;
+	WorkStealingPool<int> draw_pool;
+	
+	vector<DrawChunk*> draw_chunks;
+	size_t num_draw_chunks;
+	const vector<int> *draw_slots;
+	
+	// drawBatched() of each chunk runs on the pool, no GL calls are made
+	void recordParallel(const vector<int> &slots, const ofRectangle &view)
+	{
+		num_draw_chunks = (slots.size() + DRAW_CHUNK_SIZE - 1) / DRAW_CHUNK_SIZE;
+		draw_slots = &slots;
+		
+		while (draw_chunks.size() < num_draw_chunks)
+			draw_chunks.push_back(new DrawChunk);
+		
+		for (size_t i = 0; i < num_draw_chunks; i++)
+		{
+			DrawChunk &c = *draw_chunks[i];
+			
+			c.first = i * DRAW_CHUNK_SIZE;
+			c.last = min(slots.size(), c.first + DRAW_CHUNK_SIZE);
+			
+			// reads the style, so not on the workers
+			c.batch.begin(modelViewProjectionMatrix, view);
+			c.immediate.clear();
+			c.batched_nodes = 0;
+			
+			draw_pool.push(0, i);
+		}
+		
+		walking = true;
+		draw_pool.run(&Context::runDrawTask, this);
+		walking = false;
+	}
+	
+	static void runDrawTask(void *user, const int &chunk, int)
+	{
+		Context *ctx = (Context*)user;
+		DrawChunk &c = *ctx->draw_chunks[chunk];
+		const vector<int> &slots = *ctx->draw_slots;
+		
+		for (size_t i = c.first; i < c.last; i++)
+		{
+			Node *e = ctx->arena.node[slots[i]];
+			
+			c.batch.setTransform(ctx->arena.global[e->slot]);
+			c.batch.resetStyle();
+			
+			if (e->drawBatched(c.batch))
+				c.batched_nodes++;
+			else
+				c.immediate.push_back(make_pair(e, c.batch.getMark()));
+		}
+	}
+	
+	// appends the chunks in tree order, so consecutive chunks share draw calls
+	void submitChunks()
+	{
+		for (size_t i = 0; i < num_draw_chunks; i++)
+		{
+			DrawChunk &c = *draw_chunks[i];
+			PrimitiveBatch::Mark from;
+			
+			for (size_t k = 0; k < c.immediate.size(); k++)
+			{
+				batch.append(c.batch, from, c.immediate[k].second);
+				batch.flush();
+				
+				drawImmediate(c.immediate[k].first);
+				from = c.immediate[k].second;
+			}
+			
+			batch.append(c.batch, from, c.batch.getMark());
+			render_stats.batched_nodes += c.batched_nodes;
+		}
+	}
+	
+	void clearDrawChunks()
+	{
+		for (size_t i = 0; i < draw_chunks.size(); i++)
+			delete draw_chunks[i];
+		
+		draw_chunks.clear();
+	}
+	
+#pragma mark - update
+	
+	enum { WALKED_NONE, WALKED_NODE, WALKED_SUBTREE };
+	
+	// by slot, how far the update walk of this frame got
+	vector<char> walked;
+	
+	void updateSerial()
+	{
+		const vector<int> *order = &arena.getOrder(root->slot);
+		transform_changed.assign(arena.node.size(), false);
+		walked.assign(arena.node.size(), WALKED_NONE);
+		
+		size_t i = 1;
+		while (i < order->size())
+		{
+			const int s = (*order)[i];
+			const bool parent_changed = transform_changed[arena.parent[s]];
+			
+			if (!arena.hasFlag(s, SceneArena::VISIBLE))
+			{
+				if (parent_changed) arena.setFlag(s, SceneArena::TRANSFORM_DIRTY, true);
+				i = arena.getSubtreeEnd(s);
+				continue;
+			}
+			
+			Node *e = arena.node[s];
+			
+			// only nodes moved by an update() earlier in this frame are left
+			bool changed = parent_changed || arena.hasFlag(s, SceneArena::TRANSFORM_DIRTY);
+			if (changed) updateTransform(s);
+			
+			e->update();
+			
+			// moved by its own update(), the children see the new matrix this frame
+			if (arena.node[s] == e && arena.hasFlag(s, SceneArena::TRANSFORM_DIRTY))
+			{
+				updateTransform(s);
+				changed = true;
+			}
+			
+			if (spatial_index != SPATIAL_INDEX_NONE && arena.node[s] == e)
+				updateBounds(e);
+			
+			transform_changed[s] = changed;
+			walked[s] = WALKED_NODE;
+			i = nextInOrder(order, s, i);
+		}
+	}
+	
+	// update() may add, remove or reorder nodes. then the walk goes on with the
+	// first node of the new order that was not updated yet, each node runs once
+	size_t nextInOrder(const vector<int> *&order, int s, size_t i)
+	{
+		if (!arena.isOrderDirty() && (*order)[i] == s) return i + 1;
+		
+		order = &arena.getOrder(root->slot);
+		transform_changed.resize(arena.node.size(), false);
+		update_thread_safe.resize(arena.node.size(), false);
+		walked.resize(arena.node.size(), WALKED_NONE);
+		
+		i = 1;
+		while (i < order->size())
+		{
+			const int w = walked[(*order)[i]];
+			
+			if (w == WALKED_SUBTREE) i = arena.getSubtreeEnd((*order)[i]);
+			else if (w == WALKED_NODE) i++;
+			else break;
+		}
+		
+		return i;
+	}
+	
+#pragma mark - parallel update
+	
+	struct UpdateTask
+	{
+		int slot;
+		bool parent_changed;
+		
+		UpdateTask() {}
+		UpdateTask(int slot, bool parent_changed) : slot(slot), parent_changed(parent_changed) {}
+	};
+	
+	bool parallel_update;
+	WorkStealingPool<UpdateTask> update_pool;
+	
+	// workers only write the flags of their own subtrees, invalidations of the
+	// parents are marked on the slot and applied after the join
+	bool updating_on_workers;
+	std::atomic<bool> culling_deferred;
+	
+	// by slot, every visible node of the subtree is thread safe
+	vector<char> update_thread_safe;
+	
+	void updateParallel()
+	{
+		const vector<int> *order = &arena.getOrder(root->slot);
+		transform_changed.assign(arena.node.size(), false);
+		walked.assign(arena.node.size(), WALKED_NONE);
+		
+		markThreadSafeSubtrees();
+		
+		// nodes that are not thread safe run here in the serial order,
+		// the thread safe subtrees below them are queued
+		size_t i = 1;
+		while (i < order->size())
+		{
+			const int s = (*order)[i];
+			const bool parent_changed = transform_changed[arena.parent[s]];
+			
+			if (!arena.hasFlag(s, SceneArena::VISIBLE))
+			{
+				if (parent_changed) arena.setFlag(s, SceneArena::TRANSFORM_DIRTY, true);
+				i = arena.getSubtreeEnd(s);
+				continue;
+			}
+			
+			if (update_thread_safe[s])
+			{
+				update_pool.push(0, UpdateTask(s, parent_changed));
+				walked[s] = WALKED_SUBTREE;
+				i = arena.getSubtreeEnd(s);
+				continue;
+			}
+			
+			transform_changed[s] = updateNode(s, parent_changed);
+			walked[s] = WALKED_NODE;
+			i = nextInOrder(order, s, i);
+		}
+		
+		updating_on_workers = true;
+		update_pool.run(&Context::runUpdateTask, this);
+		updating_on_workers = false;
+		
+		if (culling_deferred) applyDeferredCulling();
+		
+		// the index is not thread safe, so bounds stay on this thread
+		if (spatial_index != SPATIAL_INDEX_NONE)
+		{
+			const vector<int> &slots = getVisibleSlots();
+			for (size_t i = 0; i < slots.size(); i++)
+				updateBounds(arena.node[slots[i]]);
+		}
+	}
+	
+	void applyDeferredCulling()
+	{
+		for (int s = 0; s < (int)arena.flags.size(); s++)
+		{
+			if (!arena.hasFlag(s, SceneArena::CULLING_DEFERRED)) continue;
+			
+			arena.setFlag(s, SceneArena::CULLING_DEFERRED, false);
+			arena.invalidateCulling(arena.parent[s]);
+		}
+		
+		culling_deferred = false;
+	}
+	
+	void markThreadSafeSubtrees()
+	{
+		update_thread_safe.assign(arena.node.size(), false);
+		
+		const vector<int> &slots = getVisibleSlots();
+		for (size_t i = 0; i < slots.size(); i++)
+			update_thread_safe[slots[i]] = arena.node[slots[i]]->isUpdateThreadSafe();
+		
+		// children come after their parents
+		for (size_t i = slots.size(); i-- > 0; )
+		{
+			const int s = slots[i];
+			if (!update_thread_safe[s]) update_thread_safe[arena.parent[s]] = false;
+		}
+	}
+	
+	static void runUpdateTask(void *user, const UpdateTask &task, int worker)
+	{
+		Context *ctx = (Context*)user;
+		SceneArena &arena = ctx->arena;
+		
+		int s = task.slot;
+		bool parent_changed = task.parent_changed;
+		
+		// continues with the first child, the others are left to steal
+		while (s != SceneArena::NONE)
+		{
+			const bool changed = ctx->updateNode(s, parent_changed);
+			int next = SceneArena::NONE;
+			
+			for (int c = arena.first_child[s]; c != SceneArena::NONE; c = arena.next_sibling[c])
+			{
+				if (!arena.hasFlag(c, SceneArena::VISIBLE))
+				{
+					if (changed) arena.setFlag(c, SceneArena::TRANSFORM_DIRTY, true);
+				}
+				else if (next == SceneArena::NONE)
+				{
+					next = c;
+				}
+				else
+				{
+					ctx->update_pool.push(worker, UpdateTask(c, changed));
+				}
+			}
+			
+			s = next;
+			parent_changed = changed;
+		}
+	}
+	
+	// returns whether the global matrix changed
+	bool updateNode(int s, bool parent_changed)
+	{
+		Node *e = arena.node[s];
+		
+		bool changed = parent_changed || arena.hasFlag(s, SceneArena::TRANSFORM_DIRTY);
+		if (changed) updateTransform(s);
+		
+		e->update();
+		
+		if (arena.node[s] == e && arena.hasFlag(s, SceneArena::TRANSFORM_DIRTY))
+		{
+			updateTransform(s);
+			changed = true;
+		}
+		
+		return changed;
+	}
+
+	ofVec3f screenToWorld(const ofVec2f &p)
+	{
+		return unproject(ofVec3f(p.x, viewport[3] - p.y, current_pointer->depth));
+	}
+
+	ofVec2f worldToScreen(const ofVec3f &p)
+	{
+		const ofVec3f s = project(p);
+		return ofVec2f(s.x, viewport[3] - s.y);
+	}
+	
+	// world -> window coordinates, y is bottom-up and z is depth in 0..1.
+	// like gluProject, GLU is not there with core profiles
+	ofVec3f project(const ofVec3f &p)
+	{
+		const ofVec4f c = modelViewProjectionMatrix.preMult(ofVec4f(p.x, p.y, p.z, 1));
+		if (c.w == 0) return ofVec3f();
+		
+		return ofVec3f(viewport[0] + (c.x / c.w + 1) * 0.5 * viewport[2],
+					   viewport[1] + (c.y / c.w + 1) * 0.5 * viewport[3],
+					   (c.z / c.w + 1) * 0.5);
+	}
+	
+	ofVec3f unproject(const ofVec3f &p)
+	{
+		const ofVec4f ndc((p.x - viewport[0]) / viewport[2] * 2 - 1,
+						  (p.y - viewport[1]) / viewport[3] * 2 - 1,
+						  p.z * 2 - 1, 1);
+		
+		const ofVec4f c = modelViewProjectionMatrixInverse.preMult(ndc);
+		if (c.w == 0) return ofVec3f();
+		
+		return ofVec3f(c.x / c.w, c.y / c.w, c.z / c.w);
+	}
+
+	// size of one pixel in world units around p
+	float getPixelSize(const ofVec3f &p)
+	{
+		if (viewport[2] <= 0 || viewport[3] <= 0) return 1;
+		
+		const ofVec3f s = project(p);
+		return unproject(s + ofVec3f(1, 0, 0)).distance(p);
+	}
+	
+	// spatial index
+	
+	// bounds of the hit shapes without calling hittest(): the shapes a caching node
+	// recorded at a pick, else the local bounds. other nodes are always tested
+	void updateBounds(Node *e)
+	{
+		const int s = e->slot;
+		
+		if (arena.hasFlag(s, SceneArena::HIT_BOUNDS_DIRTY))
+		{
+			BoundingBox local;
+			float pixel_size = 0;
+			
+			if (e->hit_shape_cache && !e->hit_shape_cache_dirty)
+				local = e->hit_shape_cache->getBounds(&pixel_size);
+			else
+				e->getLocalBounds(local);
+			
+			arena.hit_bounds[s] = local.transformed(arena.global[s]);
+			arena.pixel_pad[s] = pixel_size * 0.5;
+			arena.setFlag(s, SceneArena::HIT_BOUNDS_DIRTY, false);
+		}
+		else if (arena.pixel_pad[s] == 0) return;
+		
+		BoundingBox b = arena.hit_bounds[s];
+		
+		// pixel sized shapes use the camera of the last frame
+		if (arena.pixel_pad[s] > 0)
+			b.expand(arena.pixel_pad[s] * getPixelSize(b.getCenter()));
+		
+		if (b != arena.bounds[s])
+		{
+			arena.bounds[s] = b;
+			updateIndexItem(s);
+		}
+	}
+	
+	// the update walk gathers the bounds of the nodes it reaches, the others
+	// wait for refreshBounds()
+	void markBoundsDirty(int s)
+	{
+		arena.setFlag(s, SceneArena::HIT_BOUNDS_DIRTY, true);
+		
+		if (spatial_index != SPATIAL_INDEX_NONE && !updating_on_workers)
+			bounds_pending.push_back(s);
+	}
+	
+	void refreshBounds()
+	{
+		for (size_t i = 0; i < bounds_pending.size(); i++)
+		{
+			const int s = bounds_pending[i];
+			
+			if (arena.node[s] && arena.hasFlag(s, SceneArena::VISIBLE))
+				updateBounds(arena.node[s]);
+		}
+		
+		bounds_pending.clear();
+	}
+	
+	// refits the BVH or moves the grid rect of a node. joining or leaving the
+	// nodes without bounds changes the structure, the index is rebuilt
+	void updateIndexItem(int s)
+	{
+		if (spatial_index == SPATIAL_INDEX_NONE || index_dirty) return;
+		
+		const int item = (size_t)s < index_items.size() ? index_items[s] : -1;
+		const BoundingBox &b = arena.bounds[s];
+		
+		if (item < 0 || indexed_nodes[item] != arena.node[s] || b.isEmpty())
+		{
+			index_dirty = true;
+			return;
+		}
+		
+		if (spatial_index == SPATIAL_INDEX_BVH)
+			bvh.refit(item, b);
+		else
+			grid.move(item, getGridRect(b));
+	}
+	
+	// window coordinates of a world space box, false when it crosses the near plane
+	bool projectBounds(const BoundingBox &b, ofRectangle &rect)
+	{
+		float x0 = FLT_MAX, y0 = FLT_MAX, x1 = -FLT_MAX, y1 = -FLT_MAX;
+		
+		for (int i = 0; i < 8; i++)
+		{
+			const ofVec3f c = b.getCorner(i);
+			const ofVec4f clip = modelViewProjectionMatrix.preMult(ofVec4f(c.x, c.y, c.z, 1));
+			if (clip.w <= 0) return false;
+			
+			const float x = viewport[0] + (clip.x / clip.w + 1) * 0.5 * viewport[2];
+			const float y = viewport[1] + (clip.y / clip.w + 1) * 0.5 * viewport[3];
+			
+			x0 = min(x0, x);
+			y0 = min(y0, y);
+			x1 = max(x1, x);
+			y1 = max(y1, y);
+		}
+		
+		rect.set(x0, y0, x1 - x0, y1 - y0);
+		return true;
+	}
+	
+	// boxes crossing the near plane may cover any pixel
+	ofRectangle getGridRect(const BoundingBox &b)
+	{
+		ofRectangle r;
+		if (!projectBounds(b, r)) r.set(-FLT_MAX * 0.5, -FLT_MAX * 0.5, FLT_MAX, FLT_MAX);
+		return r;
+	}
+	
+	void buildIndex()
+	{
+		indexed_nodes.clear();
+		unbounded_nodes.clear();
+		index_items.assign(arena.node.size(), -1);
+		
+		vector<BoundingBox> boxes;
+		vector<ofRectangle> rects;
+		
+		const vector<int> &slots = getVisibleSlots();
+		for (size_t i = 0; i < slots.size(); i++)
+		{
+			const int s = slots[i];
+			Node *e = arena.node[s];
+			const BoundingBox &b = arena.bounds[s];
+			
+			if (b.isEmpty())
+			{
+				unbounded_nodes.push_back(e);
+				continue;
+			}
+			
+			index_items[s] = indexed_nodes.size();
+			indexed_nodes.push_back(e);
+			
+			if (spatial_index == SPATIAL_INDEX_BVH)
+				boxes.push_back(b);
+			else
+				rects.push_back(getGridRect(b));
+		}
+		
+		if (spatial_index == SPATIAL_INDEX_BVH)
+		{
+			bvh.build(boxes);
+			grid.clear();
+		}
+		else
+		{
+			grid.build(rects);
+			bvh.clear();
+		}
+		
+		index_dirty = false;
+		index_reproject = false;
+	}
+	
+	// the grid items keep their buckets while their cells stay the same
+	void reprojectGrid()
+	{
+		for (size_t i = 0; i < indexed_nodes.size(); i++)
+			grid.move(i, getGridRect(arena.bounds[indexed_nodes[i]->slot]));
+		
+		index_reproject = false;
+	}
+	
+	void setSpatialIndex(SpatialIndexType type)
+	{
+		if (spatial_index == type) return;
+		
+		spatial_index = type;
+		index_dirty = true;
+		bounds_pending.clear();
+		
+		if (type == SPATIAL_INDEX_NONE)
+		{
+			bvh.clear();
+			grid.clear();
+			indexed_nodes.clear();
+			unbounded_nodes.clear();
+			index_items.clear();
+		}
+	}
+	
+	// nodes to hittest for a pick region centered at the window coordinates (x, y)
+	void collectCandidates(float x, float y, float w, float h, vector<Node*> &result)
+	{
+		result.clear();
+		
+		if (spatial_index == SPATIAL_INDEX_NONE)
+		{
+			Frustum region;
+			if (culling) region = getPickFrustum(x, y, w, h);
+			
+			const vector<int> &slots = getVisibleSlots(culling ? &region : NULL, &culling_stats.pick_culled);
+			for (size_t i = 0; i < slots.size(); i++)
+			{
+				if (arena.hasFlag(slots[i], SceneArena::ENABLE))
+					result.push_back(arena.node[slots[i]]);
+			}
+			
+			return;
+		}
+		
+		refreshBounds();
+		
+		if (index_dirty) buildIndex();
+		else if (index_reproject) reprojectGrid();
+		
+		index_query_result.clear();
+		
+		if (spatial_index == SPATIAL_INDEX_BVH)
+		{
+			bvh.query(getPickFrustum(x, y, w, h), index_query_result);
+		}
+		else
+		{
+			grid.query(ofRectangle(x - w * 0.5, y - h * 0.5, w, h), index_query_result);
+		}
+		
+		for (size_t i = 0; i < index_query_result.size(); i++)
+		{
+			Node *e = indexed_nodes[index_query_result[i]];
+			if (e->getVisible() && e->getEnable()) result.push_back(e);
+		}
+		
+		for (size_t i = 0; i < unbounded_nodes.size(); i++)
+		{
+			Node *e = unbounded_nodes[i];
+			if (e->getVisible() && e->getEnable()) result.push_back(e);
+		}
+	}
+	
+	vector<Node*> candidates;
+	
+	void collectCandidates(int x, int y)
+	{
+		collectCandidates(x, viewport[3] - y, PICK_REGION_SIZE, PICK_REGION_SIZE, candidates);
+	}
+
+	// the global matrix cached by update(), unlike ofNode::transformGL()
+	// it does not walk up the parents. pop with ofPopMatrix()
+	void pushTransformGL(Node *e)
+	{
+		ofPushMatrix();
+		ofMultMatrix(arena.global[e->slot]);
+	}
+
+	struct GLSelectTarget : public HitTestTarget
+	{
+		void pushName(GLuint name) { glPushName(name); }
+		void popName() { glPopName(); }
+		void addShape(const HitShape& shape) { shape.draw(); }
+	};
+
+	void hittest()
+	{
+		GLSelectTarget target;
+		Node::hittest_target = &target;
+		
+		for (size_t i = 0; i < candidates.size(); i++)
+		{
+			Node *e = candidates[i];
+			
+			pushTransformGL(e);
+			glPushName(e->object_id);
+			e->issueHitShapes();
+			glPopName();
+			ofPopMatrix();
+		}
+		
+		Node::hittest_target = NULL;
+	}
+
+	struct Selection
+	{
+		GLuint min_depth, max_depth;
+		vector<GLuint> name_stack;
+	};
+
+	// hit records laid out flat like the GL_SELECT buffer, reused between picks
+	struct HitList
+	{
+		struct Record
+		{
+			GLuint min_depth, max_depth;
+			size_t first, count;
+			
+			// position of the node in the draw order, breaks ties in depth
+			int draw_order;
+		};
+		
+		vector<Record> records;
+		vector<GLuint> names;
+		
+		void clear()
+		{
+			records.clear();
+			names.clear();
+		}
+		
+		bool empty() const { return records.empty(); }
+		size_t size() const { return records.size(); }
+		
+		void add(GLuint min_depth, GLuint max_depth, const GLuint *name_stack, size_t count)
+		{
+			Record r;
+			r.min_depth = min_depth;
+			r.max_depth = max_depth;
+			r.first = names.size();
+			r.count = count;
+			r.draw_order = -1;
+			
+			names.insert(names.end(), name_stack, name_stack + count);
+			records.push_back(r);
+		}
+		
+		bool hasNames(size_t i, const GLuint *name_stack, size_t count) const
+		{
+			const Record &r = records[i];
+			return r.count == count && equal(name_stack, name_stack + count, names.begin() + r.first);
+		}
+		
+		void get(size_t i, Selection &s) const
+		{
+			const Record &r = records[i];
+			s.min_depth = r.min_depth;
+			s.max_depth = r.max_depth;
+			s.name_stack.assign(names.begin() + r.first, names.begin() + r.first + r.count);
+		}
+		
+		// the record with the smallest depth, without sorting
+		bool getNearest(Selection &s) const
+		{
+			if (records.empty()) return false;
+			
+			size_t nearest = 0;
+			for (size_t i = 1; i < records.size(); i++)
+			{
+				if (isNearer(records[i], records[nearest]))
+					nearest = i;
+			}
+			
+			get(nearest, s);
+			return true;
+		}
+		
+		// nearest first
+		void sort() { std::sort(records.begin(), records.end(), isNearer); }
+		
+		// at the same depth, like everything in 2D, the node drawn last is on top
+		static bool isNearer(const Record &a, const Record &b)
+		{
+			if (a.min_depth != b.min_depth) return a.min_depth < b.min_depth;
+			return a.draw_order > b.draw_order;
+		}
+	};
+	
+	HitList hit_list;
+	
+	// nearest hits by cursor position in one version of the scene. entries are
+	// recycled, so lookups don't allocate
+	struct PickMemo
+	{
+		struct Entry
+		{
+			int x, y;
+			bool hit;
+			Selection nearest;
+			
+			bool get(Selection &s) const
+			{
+				if (hit) s = nearest;
+				return hit;
+			}
+		};
+		
+		vector<Entry> entries;
+		size_t count, next, capacity;
+		unsigned int version;
+		
+		PickMemo(size_t capacity) : count(0), next(0), capacity(capacity), version(0) {}
+		
+		void clear() { count = next = 0; }
+		
+		// drops the entries when the scene changed since they were picked
+		void validate(unsigned int scene_version)
+		{
+			if (version == scene_version) return;
+			
+			clear();
+			version = scene_version;
+		}
+		
+		const Entry* find(int x, int y) const
+		{
+			for (size_t i = 0; i < count; i++)
+			{
+				if (entries[i].x == x && entries[i].y == y)
+					return &entries[i];
+			}
+			
+			return NULL;
+		}
+		
+		// overwrites the oldest entry when full
+		Entry& insert(int x, int y)
+		{
+			if (next >= entries.size()) entries.resize(next + 1);
+			
+			Entry &e = entries[next];
+			e.x = x;
+			e.y = y;
+			
+			next = (next + 1) % capacity;
+			count = min(count + 1, capacity);
+			
+			return e;
+		}
+		
+		const Entry& insert(int x, int y, const HitList &hits)
+		{
+			Entry &e = insert(x, y);
+			e.hit = hits.getNearest(e.nearest);
+			return e;
+		}
+		
+		const Entry& insert(const Entry &o)
+		{
+			Entry &e = insert(o.x, o.y);
+			e.hit = o.hit;
+			if (o.hit) e.nearest = o.nearest;
+			return e;
+		}
+	};
+	
+	// picks of the current input flush
+	enum { PICK_MEMO_SIZE = 64 };
+	PickMemo pick_memo;
+	
+	// picks kept across frames
+	enum { PICK_CACHE_SIZE = 16 };
+	
+	bool pick_cache_enabled;
+	PickMemo pick_cache;
+	PickCacheStats pick_cache_stats;
+	
+	Selection nearest_hit;
+	
+	static GLuint toSelectionDepth(float z)
+	{
+		return (GLuint)(ofClamp(z, 0, 1) * (double)0xffffffff);
+	}
+
+	// ray-casts the shapes of a node in its local space, segments and points in screen space
+	struct RaycastTarget : public HitTestTarget
+	{
+		Context &context;
+		HitList &result;
+		
+		ofVec2f window_pos;
+		Ray ray, local_ray;
+		
+		Node *node;
+		vector<GLuint> &name_stack;
+		
+		RaycastTarget(Context &context, HitList &result, int x, int y)
+			: context(context), result(result), node(NULL), name_stack(context.raycast_name_stack)
+		{
+			window_pos.set(x, context.viewport[3] - y);
+			ray = Ray(context.unproject(ofVec3f(window_pos.x, window_pos.y, 0)),
+					  context.unproject(ofVec3f(window_pos.x, window_pos.y, 1)));
+		}
+		
+		void begin(Node *e)
+		{
+			node = e;
+			local_ray = ray.transformed(context.arena.global_inverse[e->slot]);
+			
+			name_stack.clear();
+			name_stack.push_back(e->object_id);
+		}
+		
+		void pushName(GLuint name) { name_stack.push_back(name); }
+		void popName() { if (name_stack.size() > 1) name_stack.pop_back(); }
+		
+		void addShape(const HitShape& shape)
+		{
+			float z;
+			
+			if (shape.isScreenSpace())
+			{
+				if (!hitScreenSpace(shape, z)) return;
+			}
+			else
+			{
+				float t;
+				if (!shape.intersects(local_ray, t)) return;
+				
+				z = context.project(context.arena.global[node->slot].preMult(local_ray.getPoint(t))).z;
+			}
+			
+			addHit(toSelectionDepth(z));
+		}
+		
+		bool hitScreenSpace(const HitShape& shape, float &z)
+		{
+			const float radius = shape.size * 0.5 + PICK_REGION_SIZE * 0.5;
+			
+			const ofVec3f a = context.project(context.arena.global[node->slot].preMult(shape.p0));
+			const ofVec3f b = context.project(context.arena.global[node->slot].preMult(shape.p1));
+			
+			// closest point on the projected segment
+			const ofVec2f ab = ofVec2f(b) - ofVec2f(a);
+			const float len2 = ab.x * ab.x + ab.y * ab.y;
+			
+			float u = 0;
+			if (len2 > 0)
+			{
+				const ofVec2f ap = window_pos - ofVec2f(a);
+				u = ofClamp((ap.x * ab.x + ap.y * ab.y) / len2, 0, 1);
+			}
+			
+			const ofVec3f p = a + (b - a) * u;
+			if (window_pos.squareDistance(p) > radius * radius) return false;
+			
+			z = p.z;
+			return z >= 0 && z <= 1;
+		}
+		
+		void addHit(GLuint depth)
+		{
+			// merge consecutive hits with the same name stack like a GL_SELECT hit record
+			const size_t last = result.size() - 1;
+			if (!result.empty() && result.hasNames(last, &name_stack[0], name_stack.size()))
+			{
+				HitList::Record &r = result.records[last];
+				r.min_depth = min(r.min_depth, depth);
+				r.max_depth = max(r.max_depth, depth);
+				return;
+			}
+			
+			result.add(depth, depth, &name_stack[0], name_stack.size());
+		}
+	};
+	
+	vector<GLuint> raycast_name_stack;
+	
+	void pickupRaycast(int x, int y)
+	{
+		RaycastTarget target(*this, hit_list, x, y);
+		
+		Node::hittest_target = &target;
+		
+		for (size_t i = 0; i < candidates.size(); i++)
+		{
+			target.begin(candidates[i]);
+			candidates[i]->issueHitShapes();
+		}
+		
+		Node::hittest_target = NULL;
+	}
+
+	// draws the name stack of the node as a color, so raw GL hittest() code works too
+	struct ColorIdTarget : public HitTestTarget
+	{
+		Context &context;
+		vector<GLuint> name_stack;
+		
+		ColorIdTarget(Context &context) : context(context) {}
+		
+		void begin(Node *e)
+		{
+			name_stack.assign(1, e->object_id);
+			setColor();
+		}
+		
+		void pushName(GLuint name)
+		{
+			name_stack.push_back(name);
+			setColor();
+		}
+		
+		void popName()
+		{
+			if (name_stack.size() > 1) name_stack.pop_back();
+			setColor();
+		}
+		
+		void addShape(const HitShape& shape) { shape.draw(); }
+		
+		void setColor()
+		{
+			const GLuint id = context.getColorId(name_stack);
+			GLStateCache::get().setColor((id >> 16) & 0xff, (id >> 8) & 0xff, id & 0xff);
+		}
+	};
+	
+	GLuint getColorId(const vector<GLuint> &name_stack)
+	{
+		map<vector<GLuint>, GLuint>::iterator it = color_id_lookup.find(name_stack);
+		if (it != color_id_lookup.end()) return it->second;
+		
+		// 24bit of RGB
+		if (color_id_names.size() > 0xffffff)
+		{
+			ofLogWarning("ofxInteractivePrimitives") << "too many name stacks for PICKING_COLOR_ID";
+			return 0;
+		}
+		
+		const GLuint id = color_id_names.size();
+		color_id_names.push_back(name_stack);
+		color_id_lookup[name_stack] = id;
+		
+		return id;
+	}
+	
+	void renderColorId()
+	{
+		const int w = viewport[2], h = viewport[3];
+		if (w <= 0 || h <= 0) return;
+		
+		ensureTransforms();
+		
+		if (!color_id_fbo.isAllocated() || color_id_fbo.getWidth() != w || color_id_fbo.getHeight() != h)
+		{
+			ofFbo::Settings s;
+			s.width = w;
+			s.height = h;
+			s.internalformat = GL_RGBA;
+			s.useDepth = true;
+			color_id_fbo.allocate(s);
+		}
+		
+		color_id_names.assign(1, vector<GLuint>());
+		color_id_lookup.clear();
+		
+		// the cache does not track the depth func, write masks and clear values,
+		// saved by hand as core profiles have no glPushAttrib
+		GLint depth_func;
+		GLboolean color_mask[4], depth_mask;
+		GLfloat clear_color[4], clear_depth;
+		
+		glGetIntegerv(GL_DEPTH_FUNC, &depth_func);
+		glGetBooleanv(GL_COLOR_WRITEMASK, color_mask);
+		glGetBooleanv(GL_DEPTH_WRITEMASK, &depth_mask);
+		glGetFloatv(GL_COLOR_CLEAR_VALUE, clear_color);
+		glGetFloatv(GL_DEPTH_CLEAR_VALUE, &clear_depth);
+		
+		GLStateCache &gl_state = GLStateCache::get();
+		gl_state.begin();
+		
+		color_id_fbo.begin(false);
+		
+		// colors must reach the buffer unchanged. the last three are fixed function only
+		const GLenum disabled[] = {
+			GL_BLEND, GL_DITHER, GL_MULTISAMPLE, GL_LINE_SMOOTH, GL_POLYGON_SMOOTH, GL_CULL_FACE,
+			GL_LIGHTING, GL_TEXTURE_2D, GL_POINT_SMOOTH
+		};
+		
+		const size_t num_disabled = sizeof(disabled) / sizeof(disabled[0]) - (programmable ? 3 : 0);
+		
+		for (size_t i = 0; i < num_disabled; i++)
+			gl_state.setCapability(disabled[i], false);
+		
+		gl_state.setBlendMode(OF_BLENDMODE_DISABLED);
+		gl_state.setDepthTest(true);
+		glDepthFunc(GL_LEQUAL);
+		glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+		glDepthMask(GL_TRUE);
+		
+		glClearColor(0, 0, 0, 0);
+		glClearDepth(1);
+		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+		
+		gl_state.setFill(true);
+		
+		gl_state.pushMatrices(projectionMatrix, modelViewMatrix);
+		
+		ColorIdTarget target(*this);
+		Node::hittest_target = &target;
+		
+		const vector<int> &slots = getVisibleSlots(culling ? &view_frustum : NULL, &culling_stats.pick_culled);
+		for (size_t i = 0; i < slots.size(); i++)
+		{
+			Node *e = arena.node[slots[i]];
+			if (!arena.hasFlag(slots[i], SceneArena::ENABLE)) continue;
+			
+			pushTransformGL(e);
+			target.begin(e);
+			e->issueHitShapes();
+			ofPopMatrix();
+		}
+		
+		Node::hittest_target = NULL;
+		
+		gl_state.popMatrices();
+		
+		color_id_fbo.end();
+		
+		gl_state.end();
+		
+		glDepthFunc(depth_func);
+		glColorMask(color_mask[0], color_mask[1], color_mask[2], color_mask[3]);
+		glDepthMask(depth_mask);
+		glClearColor(clear_color[0], clear_color[1], clear_color[2], clear_color[3]);
+		glClearDepth(clear_depth);
+		
+		color_id_dirty = false;
+	}
+	
+	void pickupColorId(int x, int y)
+	{
+		if (color_id_dirty) renderColorId();
+		if (!color_id_fbo.isAllocated()) return;
+		
+		// pick region in buffer coordinates
+		const int half = PICK_REGION_SIZE / 2;
+		const int x0 = max(x - viewport[0] - half, 0);
+		const int y0 = max(viewport[3] - y - viewport[1] - half, 0);
+		const int x1 = min(x - viewport[0] + half + 1, (int)color_id_fbo.getWidth());
+		const int y1 = min(viewport[3] - y - viewport[1] + half + 1, (int)color_id_fbo.getHeight());
+		
+		if (x0 >= x1 || y0 >= y1) return;
+		
+		const int num_pixels = (x1 - x0) * (y1 - y0);
+		GLubyte colors[PICK_REGION_SIZE * PICK_REGION_SIZE * 4];
+		GLfloat depths[PICK_REGION_SIZE * PICK_REGION_SIZE];
+		
+		GLint prev_fbo = 0;
+		glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &prev_fbo);
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, color_id_fbo.getId());
+		
+		GLint pack_alignment;
+		glGetIntegerv(GL_PACK_ALIGNMENT, &pack_alignment);
+		
+		glPixelStorei(GL_PACK_ALIGNMENT, 1);
+		glReadPixels(x0, y0, x1 - x0, y1 - y0, GL_RGBA, GL_UNSIGNED_BYTE, colors);
+		glReadPixels(x0, y0, x1 - x0, y1 - y0, GL_DEPTH_COMPONENT, GL_FLOAT, depths);
+		glPixelStorei(GL_PACK_ALIGNMENT, pack_alignment);
+		
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, prev_fbo);
+		
+		// color id of each hit record
+		GLuint ids[PICK_REGION_SIZE * PICK_REGION_SIZE];
+		
+		for (int i = 0; i < num_pixels; i++)
+		{
+			const GLubyte *c = &colors[i * 4];
+			const GLuint id = (c[0] << 16) | (c[1] << 8) | c[2];
+			if (id == 0 || id >= color_id_names.size()) continue;
+			
+			const GLuint depth = toSelectionDepth(depths[i]);
+			
+			const GLuint *it = find(ids, ids + hit_list.size(), id);
+			if (it == ids + hit_list.size())
+			{
+				const vector<GLuint> &names = color_id_names[id];
+				
+				ids[hit_list.size()] = id;
+				hit_list.add(depth, depth, &names[0], names.size());
+			}
+			else
+			{
+				HitList::Record &r = hit_list.records[it - ids];
+				r.min_depth = min(r.min_depth, depth);
+				r.max_depth = max(r.max_depth, depth);
+			}
+		}
+	}
+
+	// every hit, sorted by depth
+	vector<Selection> pickup(int x, int y)
+	{
+		vector<Selection> result;
+		
+		// hittest timeout
+		if (ofGetElapsedTimef() - last_update_time > 0.1)
+		{
+			return result;
+		}
+		
+		performPickup(x, y);
+		hit_list.sort();
+		
+		result.resize(hit_list.size());
+		for (size_t i = 0; i < hit_list.size(); i++)
+			hit_list.get(i, result[i]);
+		
+		return result;
+	}
+	
+	// the nearest hit, which is all the mouse handlers need.
+	// answered from the input flush memo or the pick cache when possible
+	bool pickNearest(int x, int y, Selection &result)
+	{
+		// hittest timeout
+		if (ofGetElapsedTimef() - last_update_time > 0.1)
+		{
+			return false;
+		}
+		
+		const PickMemo::Entry *e = NULL;
+		
+		// a handler earlier in the flush may have changed the scene
+		if (flushing_input) pick_memo.validate(scene_version);
+		
+		if (flushing_input && (e = pick_memo.find(x, y)))
+		{
+			input_stats.picks_saved++;
+			return e->get(result);
+		}
+		
+		if (pick_cache_enabled)
+		{
+			pick_cache.validate(scene_version);
+			e = pick_cache.find(x, y);
+			
+			if (e)
+			{
+				pick_cache_stats.hits++;
+			}
+			else
+			{
+				pick_cache_stats.misses++;
+				
+				performPickup(x, y);
+				e = &pick_cache.insert(x, y, hit_list);
+			}
+			
+			if (flushing_input) pick_memo.insert(*e);
+			
+			return e->get(result);
+		}
+		
+		performPickup(x, y);
+		
+		if (flushing_input)
+			return pick_memo.insert(x, y, hit_list).get(result);
+		
+		return hit_list.getNearest(result);
+	}
+	
+	// grows on overflow
+	vector<GLuint> select_buffer;
+	enum { MAX_SELECT_BUFFER_SIZE = 1 << 22 };
+	
+	// fills hit_list
+	void performPickup(int x, int y)
+	{
+		collectHits(x, y);
+		setDrawOrder(hit_list);
+	}
+	
+	// the ties of 2D picks go to the node drawn last
+	void setDrawOrder(HitList &hits)
+	{
+		arena.getOrder(root->slot);
+		
+		for (size_t i = 0; i < hits.records.size(); i++)
+		{
+			HitList::Record &r = hits.records[i];
+			
+			const int s = arena.findSlot(hits.names[r.first]);
+			r.draw_order = s != SceneArena::NONE ? arena.getOrderIndex(s) : -1;
+		}
+	}
+	
+	void collectHits(int x, int y)
+	{
+		input_stats.picks++;
+		hit_list.clear();
+		
+		// event handlers may have moved nodes since update()
+		ensureTransforms();
+		
+		if (picking_mode == PICKING_COLOR_ID)
+		{
+			pickupColorId(x, y);
+			return;
+		}
+		
+		collectCandidates(x, y);
+		
+		if (picking_mode == PICKING_CPU)
+		{
+			pickupRaycast(x, y);
+			return;
+		}
+		
+		GLint hits;
+		
+		while (true)
+		{
+			hits = renderSelection(x, y);
+			if (hits >= 0) break;
+			
+			if (select_buffer.size() >= MAX_SELECT_BUFFER_SIZE)
+			{
+				ofLogWarning("ofxInteractivePrimitives") << "selection buffer overflow";
+				return;
+			}
+			
+			select_buffer.resize(select_buffer.size() * 2);
+		}
+		
+		const GLuint *ptr = &select_buffer[0];
+		
+		for (int i = 0; i < hits; i++)
+		{
+			GLuint num_names = ptr[0];
+			GLuint min_depth = ptr[1];
+			GLuint max_depth = ptr[2];
+			
+			hit_list.add(min_depth, max_depth, &ptr[3], num_names);
+			
+			ptr += (3 + num_names);
+		}
+	}
+	
+	// returns the number of hit records, -1 when select_buffer overflowed
+	GLint renderSelection(int x, int y)
+	{
+		GLStateCache &gl_state = GLStateCache::get();
+		gl_state.begin();
+		ofPushView();
+
+		gl_state.setDepthTest(true);
+		gl_state.setFill(true);
+
+		glSelectBuffer(select_buffer.size(), &select_buffer[0]);
+		glRenderMode(GL_SELECT);
+		glMatrixMode(GL_PROJECTION);
+
+		glPushMatrix();
+		{
+			glLoadIdentity();
+			gluPickMatrix(x, viewport[3] - y, PICK_REGION_SIZE, PICK_REGION_SIZE, viewport);
+			glMultMatrixd(projection);
+
+			glMatrixMode(GL_MODELVIEW);
+			glLoadIdentity();
+			glMultMatrixd(modelview);
+
+			hittest();
+
+			glMatrixMode(GL_PROJECTION);
+		}
+		glPopMatrix();
+
+		glMatrixMode(GL_MODELVIEW);
+
+		GLint hits = glRenderMode(GL_RENDER);
+
+		ofPopView();
+		gl_state.end();
+		
+		return hits;
+	}
+
+	// batched picking
+	
+	HitShapeRecorder batch_recorder;
+	vector<HitList> batch_hits;
+	
+	void pickupBatch(const vector<ofVec2f>& points, vector<vector<PointSelection> >& result)
+	{
+		result.clear();
+		result.resize(points.size());
+		
+		// hittest timeout
+		if (points.empty() || ofGetElapsedTimef() - last_update_time > 0.1)
+		{
+			return;
+		}
+		
+		ensureTransforms();
+		
+		if (batch_hits.size() < points.size()) batch_hits.resize(points.size());
+		
+		if (picking_mode == PICKING_COLOR_ID)
+		{
+			// a single render answers every point
+			for (size_t i = 0; i < points.size(); i++)
+			{
+				hit_list.clear();
+				pickupColorId(points[i].x, points[i].y);
+				batch_hits[i] = hit_list;
+			}
+		}
+		else
+		{
+			pickupBatchRaycast(points);
+		}
+		
+		for (size_t i = 0; i < points.size(); i++)
+		{
+			HitList &hits = batch_hits[i];
+			
+			setDrawOrder(hits);
+			hits.sort();
+			
+			vector<PointSelection> &r = result[i];
+			
+			for (size_t k = 0; k < hits.size(); k++)
+			{
+				const HitList::Record &rec = hits.records[k];
+				
+				Node *e = findElement(hits.names[rec.first]);
+				if (!e) continue;
+				
+				PointSelection s;
+				s.node = e;
+				s.name_stack.assign(hits.names.begin() + rec.first + 1, hits.names.begin() + rec.first + rec.count);
+				s.depth = (float)rec.min_depth / 0xffffffff;
+				r.push_back(s);
+			}
+		}
+	}
+	
+	void pickupBatchRaycast(const vector<ofVec2f>& points)
+	{
+		// candidates around all the points
+		ofRectangle area(points[0].x, viewport[3] - points[0].y, 0, 0);
+		for (size_t i = 1; i < points.size(); i++)
+			area.growToInclude(ofVec3f(points[i].x, viewport[3] - points[i].y, 0));
+		
+		collectCandidates(area.getCenter().x, area.getCenter().y,
+						  area.width + PICK_REGION_SIZE, area.height + PICK_REGION_SIZE, candidates);
+		
+		vector<RaycastTarget*> targets(points.size());
+		
+		for (size_t i = 0; i < points.size(); i++)
+		{
+			batch_hits[i].clear();
+			targets[i] = new RaycastTarget(*this, batch_hits[i], points[i].x, points[i].y);
+		}
+		
+		for (size_t i = 0; i < candidates.size(); i++)
+		{
+			Node *e = candidates[i];
+			
+			// hittest() runs once, its shapes are replayed for each point
+			const HitShapeRecorder &shapes = e->recordHitShapes(batch_recorder);
+			if (shapes.empty()) continue;
+			
+			float pixel_size;
+			const BoundingBox bounds = shapes.getBounds(&pixel_size).transformed(arena.global[e->slot]);
+			
+			ofRectangle rect;
+			const bool has_rect = projectBounds(bounds, rect);
+			
+			if (has_rect)
+			{
+				const float pad = (pixel_size + PICK_REGION_SIZE) * 0.5;
+				rect.set(rect.x - pad, rect.y - pad, rect.width + pad * 2, rect.height + pad * 2);
+			}
+			
+			for (size_t k = 0; k < points.size(); k++)
+			{
+				RaycastTarget &target = *targets[k];
+				if (has_rect && !rect.inside(target.window_pos)) continue;
+				
+				target.begin(e);
+				shapes.replay(target);
+			}
+		}
+		
+		for (size_t i = 0; i < targets.size(); i++) delete targets[i];
+	}
+	
+	// region query
+	
+	// tests projected hit shapes against a window space rect or polygon (y is bottom-up)
+	struct RegionTarget : public HitTestTarget
+	{
+		Context &context;
+		
+		RegionMode mode;
+		ofRectangle rect;
+		const vector<ofVec2f> *lasso;
+		
+		vector<RegionSelection> &result;
+		
+		struct Item
+		{
+			vector<GLuint> name_stack;
+			bool overlap, inside;
+		};
+		
+		Node *node;
+		ofMatrix4x4 to_clip;
+		vector<GLuint> name_stack;
+		vector<Item> items;
+		vector<ofVec3f> points;
+		
+		RegionTarget(Context &context, RegionMode mode, const ofRectangle &rect, const vector<ofVec2f> *lasso, vector<RegionSelection> &result)
+			: context(context), mode(mode), rect(rect), lasso(lasso), result(result), node(NULL) {}
+		
+		void begin(Node *e)
+		{
+			node = e;
+			to_clip = context.arena.global[e->slot] * context.modelViewProjectionMatrix;
+			
+			name_stack.clear();
+			items.clear();
+		}
+		
+		void end()
+		{
+			for (size_t i = 0; i < items.size(); i++)
+			{
+				const Item &item = items[i];
+				if (mode == REGION_CONTAIN ? !item.inside : !item.overlap) continue;
+				
+				RegionSelection s;
+				s.node = node;
+				s.name_stack = item.name_stack;
+				result.push_back(s);
+			}
+		}
+		
+		void pushName(GLuint name) { name_stack.push_back(name); }
+		void popName() { if (!name_stack.empty()) name_stack.pop_back(); }
+		
+		void addShape(const HitShape& shape)
+		{
+			getPoints(shape, points);
+			
+			bool inside = true, overlap = false;
+			float x0 = FLT_MAX, y0 = FLT_MAX, x1 = -FLT_MAX, y1 = -FLT_MAX;
+			
+			for (size_t i = 0; i < points.size(); i++)
+			{
+				ofVec2f p;
+				
+				// behind the camera
+				if (!project(points[i], p))
+				{
+					inside = false;
+					continue;
+				}
+				
+				const bool in = contains(p);
+				inside = inside && in;
+				overlap = overlap || in;
+				
+				x0 = min(x0, p.x);
+				y0 = min(y0, p.y);
+				x1 = max(x1, p.x);
+				y1 = max(y1, p.y);
+			}
+			
+			if (x0 > x1) return;
+			
+			// the corners of the bounds can leave the region while the circle is inside
+			if (shape.type == HitShape::CIRCLE)
+				inside = containsCircle(shape);
+			
+			// segments and points have a width in pixels
+			if (shape.isScreenSpace())
+			{
+				const float pad = shape.size * 0.5;
+				x0 -= pad;
+				y0 -= pad;
+				x1 += pad;
+				y1 += pad;
+			}
+			
+			if (!overlap) overlap = overlaps(ofRectangle(x0, y0, x1 - x0, y1 - y0));
+			
+			// consecutive shapes with the same name stack are one item
+			if (!items.empty() && items.back().name_stack == name_stack)
+			{
+				Item &item = items.back();
+				item.inside = item.inside && inside;
+				item.overlap = item.overlap || overlap;
+				return;
+			}
+			
+			Item item;
+			item.name_stack = name_stack;
+			item.inside = inside;
+			item.overlap = overlap;
+			items.push_back(item);
+		}
+		
+		static void getPoints(const HitShape& shape, vector<ofVec3f> &points)
+		{
+			points.clear();
+			
+			switch (shape.type)
+			{
+				case HitShape::SEGMENT:
+				case HitShape::POINT:
+					points.push_back(shape.p0);
+					points.push_back(shape.p1);
+					break;
+					
+				case HitShape::POLYGON:
+					points.assign(shape.mesh.vertices, shape.mesh.vertices + shape.mesh.num_vertices);
+					break;
+					
+				case HitShape::ORIENTED_BOX:
+				{
+					const BoundingBox unit(ofVec3f(-0.5, -0.5, -0.5), ofVec3f(0.5, 0.5, 0.5));
+					const ofMatrix4x4 m = shape.getMatrix();
+					for (int i = 0; i < 8; i++)
+						points.push_back(m.preMult(unit.getCorner(i)));
+					break;
+				}
+					
+				default:
+				{
+					const BoundingBox b = shape.getBounds();
+					for (int i = 0; i < 8; i++)
+						points.push_back(b.getCorner(i));
+					break;
+				}
+			}
+		}
+		
+		bool project(const ofVec3f &v, ofVec2f &p) const
+		{
+			const ofVec4f clip = to_clip.preMult(ofVec4f(v.x, v.y, v.z, 1));
+			if (clip.w <= 0) return false;
+			
+			p.set(context.viewport[0] + (clip.x / clip.w + 1) * 0.5 * context.viewport[2],
+				  context.viewport[1] + (clip.y / clip.w + 1) * 0.5 * context.viewport[3]);
+			return true;
+		}
+		
+		bool contains(const ofVec2f &p) const
+		{
+			if (!rect.inside(p)) return false;
+			return lasso == NULL || insidePolygon(*lasso, p);
+		}
+		
+		// the center is inside and no edge of the region comes nearer than the radius.
+		// the circle projects to the ellipse spanned by its radius along local x and y,
+		// the edges are mapped to where that ellipse is the unit circle
+		bool containsCircle(const HitShape& shape) const
+		{
+			ofVec2f c, a, b;
+			if (!project(shape.p0, c)
+				|| !project(shape.p0 + ofVec3f(shape.size, 0, 0), a)
+				|| !project(shape.p0 + ofVec3f(0, shape.size, 0), b))
+				return false;
+			
+			if (!contains(c)) return false;
+			
+			const ofVec2f u = a - c, v = b - c;
+			const float det = u.x * v.y - u.y * v.x;
+			
+			// seen edge on, a segment
+			if (fabs(det) < 1e-6)
+				return contains(c + u) && contains(c - u) && contains(c + v) && contains(c - v);
+			
+			vector<ofVec2f> edges(4);
+			edges[0].set(rect.getMinX(), rect.getMinY());
+			edges[1].set(rect.getMaxX(), rect.getMinY());
+			edges[2].set(rect.getMaxX(), rect.getMaxY());
+			edges[3].set(rect.getMinX(), rect.getMaxY());
+			if (lasso) edges.insert(edges.end(), lasso->begin(), lasso->end());
+			
+			for (size_t i = 0; i < edges.size(); i++)
+			{
+				const ofVec2f d = edges[i] - c;
+				edges[i].set((d.x * v.y - d.y * v.x) / det, (u.x * d.y - u.y * d.x) / det);
+			}
+			
+			for (size_t i = 0; i < 4; i++)
+			{
+				if (nearerThanOne(edges[i], edges[(i + 1) % 4])) return false;
+			}
+			
+			for (size_t i = 4, j = edges.size() - 1; i < edges.size(); j = i++)
+			{
+				if (nearerThanOne(edges[i], edges[j])) return false;
+			}
+			
+			return true;
+		}
+		
+		// whether the segment passes within the unit circle around the origin
+		static bool nearerThanOne(const ofVec2f &p0, const ofVec2f &p1)
+		{
+			const ofVec2f d = p1 - p0;
+			const float len = d.lengthSquared();
+			const float t = len > 0 ? ofClamp(-p0.dot(d) / len, 0, 1) : 0;
+			return (p0 + d * t).lengthSquared() < 1;
+		}
+		
+		bool overlaps(const ofRectangle &r) const
+		{
+			if (!rect.intersects(r)) return false;
+			if (lasso == NULL) return true;
+			
+			// a lasso vertex inside the shape, the other way was tested by contains()
+			for (size_t i = 0; i < lasso->size(); i++)
+			{
+				if (r.inside((*lasso)[i])) return true;
+			}
+			
+			return false;
+		}
+	};
+	
+	static bool insidePolygon(const vector<ofVec2f> &polygon, const ofVec2f &p)
+	{
+		bool inside = false;
+		
+		for (size_t i = 0, j = polygon.size() - 1; i < polygon.size(); j = i++)
+		{
+			const ofVec2f &a = polygon[i], &b = polygon[j];
+			
+			if ((a.y > p.y) != (b.y > p.y)
+				&& p.x < (b.x - a.x) * (p.y - a.y) / (b.y - a.y) + a.x)
+				inside = !inside;
+		}
+		
+		return inside;
+	}
+	
+	vector<Node*> region_candidates;
+	
+	// rect and lasso are in screen coordinates like mouse events
+	void queryRegion(const ofRectangle &screen_rect, const vector<ofVec2f> *screen_lasso, RegionMode mode, vector<RegionSelection> &result)
+	{
+		result.clear();
+		ensureTransforms();
+		
+		ofRectangle rect = screen_rect;
+		rect.standardize();
+		rect.y = viewport[3] - rect.getMaxY();
+		
+		vector<ofVec2f> lasso;
+		if (screen_lasso)
+		{
+			lasso = *screen_lasso;
+			for (size_t i = 0; i < lasso.size(); i++)
+				lasso[i].y = viewport[3] - lasso[i].y;
+		}
+		
+		collectCandidates(rect.getCenter().x, rect.getCenter().y, rect.width, rect.height, region_candidates);
+		
+		RegionTarget target(*this, mode, rect, screen_lasso ? &lasso : NULL, result);
+		Node::hittest_target = &target;
+		
+		for (size_t i = 0; i < region_candidates.size(); i++)
+		{
+			target.begin(region_candidates[i]);
+			region_candidates[i]->issueHitShapes();
+			target.end();
+		}
+		
+		Node::hittest_target = NULL;
+	}
+	
+	ofVec3f getLocalPosition(int x, int y)
+	{
+		const ofVec3f p = unproject(ofVec3f(x, y, current_pointer->depth));
+		return ofVec2f(p.x, viewport[3] - p.y);
+	}
+
+	// input coalescing
+	
+	// true when the event is deferred to flushInput()
+	bool queuePointerEvent(PointerEventType type, int pointer, float x, float y, int button)
+	{
+		if (!input_coalescing || flushing_input) return false;
+		
+		input_stats.events_received++;
+		
+		// the last queued event of the same pointer
+		for (size_t i = input_queue.size(); i > 0; i--)
+		{
+			QueuedPointerEvent &last = input_queue[i - 1];
+			if (last.pointer != pointer) continue;
+			
+			// only the last position of a run of moves or drags matters
+			if (last.type == type
+				&& (type == POINTER_MOVED || (type == POINTER_DRAGGED && last.button == button)))
+			{
+				last.x = x;
+				last.y = y;
+				
+				input_stats.events_coalesced++;
+				if (type == POINTER_MOVED) input_stats.picks_saved++;
+				
+				return true;
+			}
+			
+			break;
+		}
+		
+		QueuedPointerEvent q;
+		q.type = type;
+		q.pointer = pointer;
+		q.x = x;
+		q.y = y;
+		q.button = button;
+		input_queue.push_back(q);
+		
+		return true;
+	}
+	
+	void flushInput()
+	{
+		if (input_queue.empty()) return;
+		
+		flushing_input = true;
+		
+		for (size_t i = 0; i < input_queue.size(); i++)
+		{
+			const QueuedPointerEvent &e = input_queue[i];
+			
+			switch (e.type)
+			{
+				case POINTER_PRESSED: pointerPressed(e.pointer, e.x, e.y, e.button); break;
+				case POINTER_RELEASED: pointerReleased(e.pointer, e.x, e.y, e.button); break;
+				case POINTER_MOVED: pointerMoved(e.pointer, e.x, e.y); break;
+				case POINTER_DRAGGED: pointerDragged(e.pointer, e.x, e.y, e.button); break;
+			}
+		}
+		
+		input_queue.clear();
+		pick_memo.clear();
+		
+		flushing_input = false;
+	}
+	
+	void setInputCoalescing(bool yn)
 	{
-		glGetDoublev(GL_PROJECTION_MATRIX, projection);
-		glGetDoublev(GL_MODELVIEW_MATRIX, modelview);
-		glGetIntegerv(GL_VIEWPORT, viewport);
+		input_coalescing = yn;
+		if (!input_coalescing) flushInput();
 	}
+
+	// event callbacks, the mouse is pointer 0
+
+	void mousePressed(ofMouseEventArgs &e) { pointerPressed(0, e.x, e.y, e.button); }
+	void mouseReleased(ofMouseEventArgs &e) { pointerReleased(0, e.x, e.y, e.button); }
+	void mouseMoved(ofMouseEventArgs &e) { pointerMoved(0, e.x, e.y); }
+	void mouseDragged(ofMouseEventArgs &e) { pointerDragged(0, e.x, e.y, e.button); }
 	
-	void update()
+	// pointer dispatch
+	
+	// the node under the dispatched pointer before its event
+	NodeHandle hovered_before;
+	
+	// the node whose focus flag is set, reset by every event
+	NodeHandle focus_state;
+	
+	// each pointer hovers one node, a node is hovered while any pointer is over it
+	void setHover(Node *o)
 	{
-		last_update_time = ofGetElapsedTimef();
+		Pointer &ptr = *current_pointer;
+		if (ptr.hover_object == o) return;
+		
+		if (o != hovered_before) o->num_hovers++;
+		ptr.hover_object = o;
 	}
 	
-	float getLastUpdateTime() { return last_update_time; }
-
-	ofVec3f screenToWorld(const ofVec2f &p)
+	void setFocusState(Node *o)
 	{
-		double x, y, z;
-
-		gluUnProject(p.x, viewport[3] - p.y, current_depth,
-					 modelview, projection, viewport,
-					 &x, &y, &z);
-
-		return ofVec3f(x, y, z);
+		o->focus = true;
+		focus_state = o;
 	}
-
-	ofVec2f worldToScreen(const ofVec3f &p)
+	
+	Pointer& beginPointer(int id)
 	{
-		double x, y, z;
-
-		gluProject(p.x, p.y, p.z,
-				   modelview, projection, viewport,
-				   &x, &y, &z);
-
-		y = viewport[3] - y;
-
-		return ofVec2f(x, y);
+		if (focus_state) focus_state->focus = false;
+		focus_state = NULL;
+		
+		current_pointer_id = id;
+		current_pointer = &pointers[id];
+		
+		hovered_before = current_pointer->hover_object;
+		current_pointer->hover_object = NULL;
+		
+		return *current_pointer;
 	}
-
-	void hittest()
+	
+	// enter and exit when the first pointer comes over a node and the last one leaves it
+	void endPointer()
 	{
-		ElemetsContainer::iterator it = elements.begin();
+		Node *before = hovered_before;
+		Node *after = current_pointer->hover_object;
 		
-		while (it != elements.end())
+		if (before != after)
 		{
-			Node *e = it->second;
-			
-			if (e->getVisible() && e->getEnable())
-			{
-				e->transformGL();
-				glPushName(e->object_id);
-				e->hittest();
-				glPopName();
-				e->restoreTransformGL();
-			}
-
-			it++;
+			if (before && --before->num_hovers == 0) before->mouseExited();
+			if (after && after->num_hovers == 1) after->mouseEntered();
 		}
+		
+		hovered_before = NULL;
+		
+		current_pointer_id = 0;
+		current_pointer = &pointers[0];
 	}
-
-	struct Selection
-	{
-		GLuint min_depth, max_depth;
-		vector<GLuint> name_stack;
-	};
-
-	static bool sort_by_depth(const Selection &a, const Selection &b)
+	
+	// the nearest node under the pointer, the name stack and depth of the pointer follow the hit
+	Node* pickPointer(Pointer &ptr, float x, float y, bool &hit)
 	{
-		return a.min_depth < b.min_depth;
+		hit = pickNearest(x, y, nearest_hit);
+		if (!hit) return NULL;
+		
+		Selection &s = nearest_hit;
+		ptr.depth = (float)s.min_depth / 0xffffffff;
+		
+		if (s.name_stack.empty()) return NULL;
+		
+		ptr.name_stack.assign(s.name_stack.begin() + 1, s.name_stack.end());
+		
+		return findElement(s.name_stack[0]);
 	}
-
-	vector<Selection> pickup(int x, int y)
+	
+	ofVec3f toNodeLocal(Node *w, float x, float y)
 	{
-		// hittest timeout
-		if (ofGetElapsedTimef() - last_update_time > 0.1)
-		{
-			return vector<Selection>();
-		}
+		ofVec3f p = getLocalPosition(x, y);
 		
-		const int BUFSIZE = 256;
-		GLuint selectBuf[BUFSIZE];
-		GLint hits;
-
-		glPushAttrib(GL_ALL_ATTRIB_BITS);
-		ofPushStyle();
-		ofPushView();
-
-		glEnable(GL_DEPTH_TEST);
-		ofFill();
-
-		glSelectBuffer(BUFSIZE, selectBuf);
-		glRenderMode(GL_SELECT);
-		glMatrixMode(GL_PROJECTION);
-
-		glPushMatrix();
-		{
-			glLoadIdentity();
-			gluPickMatrix(x, viewport[3] - y, 5.0, 5.0, viewport);
-			glMultMatrixd(projection);
-
-			glMatrixMode(GL_MODELVIEW);
-			glLoadIdentity();
-			glMultMatrixd(modelview);
-
-			hittest();
-
-			glMatrixMode(GL_PROJECTION);
-		}
-		glPopMatrix();
-
-		glMatrixMode(GL_MODELVIEW);
-
-		hits = glRenderMode(GL_RENDER);
-
-		ofPopView();
-		ofPopStyle();
-		glPopAttrib();
-
-		if (hits <= 0) return vector<Selection>();
-
-		GLuint *ptr = selectBuf;
-
-		vector<Selection> picked_stack;
-
-		for (int i = 0; i < hits; i++)
-		{
-			GLuint num_names = ptr[0];
-			GLuint min_depth = ptr[1];
-			GLuint max_depth = ptr[2];
-
-			GLuint *names = &ptr[3];
-
-			Selection d;
-
-			d.min_depth = min_depth;
-			d.max_depth = max_depth;
-			d.name_stack.insert(d.name_stack.begin(), names, (names + num_names));
-
-			picked_stack.push_back(d);
-
-			ptr += (3 + num_names);
-		}
-
-		sort(picked_stack.begin(), picked_stack.end(), sort_by_depth);
-
-		return picked_stack;
+		ensureTransforms();
+		return arena.global_inverse[w->slot].preMult(p);
 	}
-
-	ofVec3f getLocalPosition(int x, int y)
+	
+	static void setDown(Node *w, int pointer, bool yn)
 	{
-		GLdouble ox, oy, oz;
-
-		gluUnProject(x, y, current_depth,
-					 modelview, projection, viewport,
-					 &ox, &oy, &oz);
-
-		oy = viewport[3] - oy;
-
-		return ofVec2f(ox, oy);
+		vector<int> &v = w->down_pointers;
+		vector<int>::iterator it = find(v.begin(), v.end(), pointer);
+		
+		if (yn && it == v.end()) v.push_back(pointer);
+		if (!yn && it != v.end()) v.erase(it);
 	}
 
-	// event callbacks
-
-	void mousePressed(ofMouseEventArgs &e)
+	void pointerPressed(int id, float x, float y, int button)
 	{
-		ElemetsContainer::iterator it = elements.begin();
-		while (it != elements.end())
-		{
-			it->second->clearState();
-			it++;
-		}
-
-		vector<Selection> p = pickup(e.x, e.y);
-
-		if (!p.empty())
+		if (queuePointerEvent(POINTER_PRESSED, id, x, y, button)) return;
+		
+		Pointer &ptr = beginPointer(id);
+		
+		bool hit;
+		Node *w = pickPointer(ptr, x, y, hit);
+		
+		if (w)
 		{
-			Selection &s = p[0];
-			current_depth = (float)s.min_depth / 0xffffffff;
-			
-			if (s.name_stack.size())
-			{
-				GLuint oid = s.name_stack.at(0);
-				
-				current_name_stack.assign(s.name_stack.begin() + 1, s.name_stack.end());
-				
-				ElemetsContainer::iterator it = elements.find(oid);
-				if (it == elements.end()) goto __end__;
-
-				Node *w = it->second;
-				if (w == NULL) goto __end__;
+			ofVec3f p = toNodeLocal(w, x, y);
 
-				ofVec3f p = getLocalPosition(e.x, e.y);
-				p = w->getGlobalTransformMatrix().getInverse().preMult(p);
+			setHover(w);
+			setDown(w, id, true);
 
-				w->hover = true;
-				w->down = true;
+			ptr.current_object = w;
 
-				current_object = w;
-
-				focusWillLost(focus_object);
-				focus_object = w;
-				
-				w->mousePressed(p.x, p.y, e.button);
-			}
+			focusWillLost(focus_object);
+			focus_object = w;
 			
-			__end__:;
+			w->pointerPressed(id, p.x, p.y, button);
 		}
-		else
+		else if (!hit)
 		{
-			current_object = NULL;
+			ptr.current_object = NULL;
 
 			focusWillLost(focus_object);
 			focus_object = NULL;
 			
-			current_name_stack.clear();
+			ptr.name_stack.clear();
 		}
 
 		if (focus_object)
-			focus_object->focus = true;
+			setFocusState(focus_object);
+		
+		endPointer();
 	}
 
-	void mouseReleased(ofMouseEventArgs &e)
+	void pointerReleased(int id, float x, float y, int button)
 	{
-		ElemetsContainer::iterator it = elements.begin();
-		while (it != elements.end())
-		{
-			it->second->clearState();
-			it++;
-		}
+		if (queuePointerEvent(POINTER_RELEASED, id, x, y, button)) return;
+		
+		Pointer &ptr = beginPointer(id);
 
 		if (focus_object)
-			focus_object->focus = true;
+			setFocusState(focus_object);
 
-		vector<Selection> p = pickup(e.x, e.y);
-
-		if (!p.empty())
+		bool hit;
+		Node *w = pickPointer(ptr, x, y, hit);
+		
+		if (w)
 		{
-			Selection &s = p[0];
-			current_depth = (float)s.min_depth / 0xffffffff;
+			ofVec3f p = toNodeLocal(w, x, y);
 
-			if (s.name_stack.size())
-			{
-				Node *w = elements[s.name_stack.at(0)];
-				ofVec3f p = getLocalPosition(e.x, e.y);
-				p = w->getGlobalTransformMatrix().getInverse().preMult(p);
-
-				w->hover = true;
-				w->mouseReleased(p.x, p.y, e.button);
-			}
+			setHover(w);
+			w->pointerReleased(id, p.x, p.y, button);
 		}
 
-		current_name_stack.clear();
+		ptr.name_stack.clear();
 		
-		if (current_object)
+		if (ptr.current_object)
 		{
-			ofVec3f p = getLocalPosition(e.x, e.y);
-			p = current_object->getGlobalTransformMatrix().getInverse().preMult(p);
+			Node *o = ptr.current_object;
+			ofVec3f p = toNodeLocal(o, x, y);
 
-			current_object->mouseReleased(p.x, p.y, e.button);
-			current_object->down = false;
-			current_object = NULL;
+			o->pointerReleased(id, p.x, p.y, button);
+			setDown(o, id, false);
+			ptr.current_object = NULL;
 		}
+		
+		endPointer();
 	}
 
-	void mouseMoved(ofMouseEventArgs &e)
+	void pointerMoved(int id, float x, float y)
 	{
-		ElemetsContainer::iterator it = elements.begin();
-		while (it != elements.end())
-		{
-			it->second->clearState();
-			it++;
-		}
+		if (queuePointerEvent(POINTER_MOVED, id, x, y, 0)) return;
+		
+		Pointer &ptr = beginPointer(id);
 
 		if (focus_object)
-			focus_object->focus = true;
+			setFocusState(focus_object);
 
-		vector<Selection> p = pickup(e.x, e.y);
-
-		if (!p.empty())
+		bool hit;
+		Node *w = pickPointer(ptr, x, y, hit);
+		
+		if (w)
 		{
-			Selection &s = p[0];
-			current_depth = (float)s.min_depth / 0xffffffff;
-
-			if (s.name_stack.size())
-			{
-				Node *w = elements[s.name_stack.at(0)];
-				
-				current_name_stack.assign(s.name_stack.begin() + 1, s.name_stack.end());
-
-				ofVec3f p = getLocalPosition(e.x, e.y);
-				p = w->getGlobalTransformMatrix().getInverse().preMult(p);
+			ofVec3f p = toNodeLocal(w, x, y);
 
-				w->hover = true;
-				w->mouseMoved(p.x, p.y);
-			}
+			setHover(w);
+			w->pointerMoved(id, p.x, p.y);
 		}
-		else
+		else if (!hit)
 		{
-			current_name_stack.clear();
+			ptr.name_stack.clear();
 		}
 
-		if (current_object)
+		// a move while captured means the release was missed
+		if (ptr.current_object)
 		{
-			current_object->down = false;
-			current_object = NULL;
+			setDown(ptr.current_object, id, false);
+			ptr.current_object = NULL;
 			
-			current_name_stack.clear();
+			ptr.name_stack.clear();
 		}
+		
+		endPointer();
 	}
 
-	void mouseDragged(ofMouseEventArgs &e)
+	void pointerDragged(int id, float x, float y, int button)
 	{
-		ElemetsContainer::iterator it = elements.begin();
-		while (it != elements.end())
-		{
-			it->second->clearState();
-			it++;
-		}
+		if (queuePointerEvent(POINTER_DRAGGED, id, x, y, button)) return;
+		
+		Pointer &ptr = beginPointer(id);
 
 		if (focus_object)
-			focus_object->focus = true;
+			setFocusState(focus_object);
 
-		if (current_object)
+		if (ptr.current_object)
 		{
-			ofVec3f p = getLocalPosition(e.x, e.y);
-			p = current_object->getGlobalTransformMatrix().getInverse().preMult(p);
+			Node *o = ptr.current_object;
+			ofVec3f p = toNodeLocal(o, x, y);
 
-			current_object->hover = true;
-			current_object->mouseDragged(p.x, p.y, e.button);
+			setHover(o);
+			o->pointerDragged(id, p.x, p.y, button);
 		}
+		
+		endPointer();
 	}
 
 	map<int, bool> current_focus_key;
@@ -444,9 +2747,9 @@ public:
 	void setFocus(Node *o)
 	{
 		assert(o);
-		current_object = o;
+		pointers[0].current_object = o;
 		focus_object = o;
-		focus_object->focus = true;
+		setFocusState(o);
 	}
 	
 	void clearFocus()
@@ -457,170 +2760,488 @@ public:
 			focus_object = NULL;
 		}
 		
-		if (current_object)
-		{
-			current_object = NULL;
-		}
+		pointers[0].current_object = NULL;
 		
 		current_focus_key.clear();
 	}
 };
 
-Node::Node() : object_id(0), hover(false), down(false), visible(true), focus(false), enable(true), ofNode()
+// NodeHandle
+
+NodeHandle::NodeHandle(Node *o) : context(NULL), id(0)
+{
+	if (o)
+	{
+		context = o->registered_context;
+		id = o->object_id;
+	}
+}
+
+Node* NodeHandle::get() const
+{
+	return context ? context->findElement(id) : NULL;
+}
+
+// Node
+
+HitTestTarget* Node::hittest_target = NULL;
+
+Node::Node() : ofNode(), object_id(0), registered_context(NULL), slot(SceneArena::NONE), num_hovers(0), focus(false), visible(true), enable(true), layer(0), has_local_bounds(false), hit_shape_cache(NULL), hit_shape_cache_dirty(true)
+{
+}
+
+Node::~Node()
+{
+	// a node destroyed without dispose(), e.g. a member declared after the root,
+	// must not stay in the children of its parent or the scene
+	if (getParent()) clearParent();
+
+	for (size_t i = 0; i < children.size(); i++)
+		children[i]->ofNode::clearParent();
+
+	delete hit_shape_cache;
+}
+
+void Node::dispose()
+{
+	cancelFocus();
+	clearState();
+	clearParent();
+}
+
+ofVec2f Node::getMouseDelta()
+{
+	return ofVec2f(ofGetMouseX() - ofGetPreviousMouseX(), ofGetMouseY() - ofGetPreviousMouseY());
+}
+	
+const vector<GLuint>& Node::getCurrentNameStack()
+{
+	return getContext()->current_pointer->name_stack;
+}
+
+int Node::getCurrentPointer()
+{
+	return getContext()->current_pointer_id;
+}
+
+bool Node::isHover(int pointer) const
+{
+	if (!registered_context) return false;
+	
+	const Context::PointerContainer &pointers = registered_context->pointers;
+	Context::PointerContainer::const_iterator it = pointers.find(pointer);
+	
+	return it != pointers.end() && it->second.hover_object == this;
+}
+
+bool Node::isDown(int pointer) const
+{
+	return find(down_pointers.begin(), down_pointers.end(), pointer) != down_pointers.end();
+}
+
+ofVec3f Node::localToGlobalPos(const ofVec3f& v)
+{
+	if (slot == SceneArena::NONE) return getGlobalTransformMatrix().preMult(v);
+	
+	registered_context->ensureTransforms();
+	return registered_context->arena.global[slot].preMult(v);
+}
+
+ofVec3f Node::globalToLocalPos(const ofVec3f& v)
+{
+	if (slot == SceneArena::NONE) return getGlobalTransformMatrix().getInverse().preMult(v);
+	
+	registered_context->ensureTransforms();
+	return registered_context->arena.global_inverse[slot].preMult(v);
+}
+
+ofVec3f Node::screenToWorld(const ofVec2f& v)
+{
+	return getContext()->screenToWorld(v);
+}
+
+ofVec2f Node::worldToScreen(const ofVec3f& v)
+{
+	return getContext()->worldToScreen(v);
+}
+
+void Node::setParent(Node *o)
+{
+	Context *ctx = registered_context;
+	
+	// moving inside the scene keeps the slot and the id
+	if (ctx && getParent() && o->getContext() == ctx)
+	{
+		vector<Node*> &p_children = getParent()->children;
+		p_children.erase(remove(p_children.begin(), p_children.end(), this), p_children.end());
+		
+		ofNode::clearParent();
+		ofNode::setParent(*o);
+		o->insertChild(this, true);
+		
+		ctx->moveElement(this);
+		markTransformDirty();
+		return;
+	}
+	
+	if (getParent())
+		clearParent();
+
+	ofNode::setParent(*o);
+	o->insertChild(this, true);
+	
+	markTransformDirty();
+
+	// a parent outside any scene registers this with its own subtree later
+	Context *parent_ctx = getContext();
+	if (parent_ctx && !parent_ctx->registerElement(this))
+	{
+		vector<Node*> &p_children = o->children;
+		p_children.erase(remove(p_children.begin(), p_children.end(), this), p_children.end());
+		ofNode::clearParent();
+	}
+}
+
+void Node::clearParent()
+{
+	Context *ctx = getContext();
+	if (ctx) ctx->unregisterElement(this);
+	
+	Node *p = getParent();
+	if (p)
+	{
+		vector<Node*> &p_children = p->children;
+		vector<Node*>::iterator it;
+
+		it = remove(p_children.begin(), p_children.end(), this);
+		p_children.erase(it, p_children.end());
+	}
+
+	ofNode::clearParent();
+	
+	markTransformDirty();
+}
+
+size_t Node::insertChild(Node *o, bool front)
 {
+	size_t i;
+	
+	if (front)
+	{
+		// usually every sibling is in the same layer, then this appends
+		i = children.size();
+		while (i > 0 && children[i - 1]->layer > o->layer) i--;
+	}
+	else
+	{
+		i = 0;
+		while (i < children.size() && children[i]->layer < o->layer) i++;
+	}
+	
+	children.insert(children.begin() + i, o);
+	return i;
 }
 
-Node::~Node()
+void Node::reorder(bool front)
 {
+	Node *p = getParent();
+	if (!p) return;
+	
+	vector<Node*> &p_children = p->children;
+	const size_t prev = find(p_children.begin(), p_children.end(), this) - p_children.begin();
+	
+	p_children.erase(p_children.begin() + prev);
+	if (p->insertChild(this, front) == prev) return;
+	
+	if (registered_context) registered_context->reorderElement(this);
 }
 
-void Node::dispose()
+void Node::setLayer(int l)
 {
-	cancelFocus();
-	clearState();
-	clearParent();
+	if (layer == l) return;
+	
+	layer = l;
+	reorder(true);
 }
 
-ofVec2f Node::getMouseDelta()
+void Node::clearChildren()
 {
-	return ofVec2f(ofGetMouseX() - ofGetPreviousMouseX(), ofGetMouseY() - ofGetPreviousMouseY());
-}
+	for (size_t i = 0; i < children.size(); i++)
+		children[i]->cancelFocus();
 	
-const vector<GLuint>& Node::getCurrentNameStack()
-{
-	return getContext()->current_name_stack;
+	// the subtrees leave the scene together and are detached up front,
+	// so each dispose() finds nothing to unregister or remove from
+	vector<Node*> detached;
+	detached.swap(children);
+	
+	Context *ctx = getContext();
+	if (ctx) ctx->unregisterElements(detached);
+	
+	for (size_t i = 0; i < detached.size(); i++)
+	{
+		detached[i]->ofNode::clearParent();
+		detached[i]->dispose();
+	}
 }
 
-ofVec3f Node::localToGlobalPos(const ofVec3f& v)
+void Node::markSceneChanged()
 {
-	return global_matrix.preMult(v);
+	Context *ctx = getContext();
+	if (ctx) ctx->scene_version++;
 }
 
-ofVec3f Node::globalToLocalPos(const ofVec3f& v)
+void Node::markHitShapeDirty()
 {
-	return global_matrix_inverse.preMult(v);
+	hit_shape_cache_dirty = true;
+	
+	if (slot != SceneArena::NONE)
+		registered_context->markBoundsDirty(slot);
+	
+	markSceneChanged();
 }
 
-ofVec3f Node::screenToWorld(const ofVec2f& v)
+void Node::setHitShapeCaching(bool yn)
 {
-	return getContext()->screenToWorld(v);
+	if (yn == getHitShapeCaching()) return;
+	
+	if (yn)
+	{
+		hit_shape_cache = new HitShapeRecorder;
+		hit_shape_cache_dirty = true;
+	}
+	else
+	{
+		delete hit_shape_cache;
+		hit_shape_cache = NULL;
+	}
 }
 
-ofVec2f Node::worldToScreen(const ofVec3f& v)
+const HitShapeRecorder& Node::recordHitShapes(HitShapeRecorder &recorder)
 {
-	return getContext()->worldToScreen(v);
+	HitShapeRecorder &target = hit_shape_cache ? *hit_shape_cache : recorder;
+	
+	if (!hit_shape_cache || hit_shape_cache_dirty)
+	{
+		HitTestTarget *prev_target = hittest_target;
+		
+		target.clear();
+		hittest_target = &target;
+		hittest();
+		hittest_target = prev_target;
+		
+		if (hit_shape_cache)
+		{
+			hit_shape_cache_dirty = false;
+			
+			// the index takes the bounds of the recorded shapes
+			if (slot != SceneArena::NONE) registered_context->markBoundsDirty(slot);
+		}
+	}
+	
+	return target;
 }
 
-void Node::setParent(Node *o)
+void Node::issueHitShapes()
 {
-	if (getParent())
-		clearParent();
-
-	ofNode::setParent(*o);
-	o->children.push_back(this);
-
-	getContext()->registerElement(this);
+	if (!hit_shape_cache)
+	{
+		hittest();
+		return;
+	}
+	
+	recordHitShapes(*hit_shape_cache);
+	if (hittest_target) hit_shape_cache->replay(*hittest_target);
 }
 
-void Node::clearParent()
+void Node::markTransformDirty()
 {
-	getContext()->unregisterElement(this);
+	if (slot != SceneArena::NONE)
+		registered_context->markTransformDirty(slot);
 	
-	Node *p = getParent();
-	if (p)
-	{
-		vector<Node*> &p_children = p->children;
-		vector<Node*>::iterator it;
+	markSceneChanged();
+}
 
-		it = remove(p_children.begin(), p_children.end(), this);
-		p_children.erase(it, p_children.end());
+void Node::onStateChanged()
+{
+	if (slot != SceneArena::NONE)
+	{
+		SceneArena &arena = registered_context->arena;
+		
+		// hidden subtrees are left out of the spatial index
+		if (visible != arena.hasFlag(slot, SceneArena::VISIBLE))
+			registered_context->index_dirty = true;
+		
+		arena.setFlag(slot, SceneArena::VISIBLE, visible);
+		arena.setFlag(slot, SceneArena::ENABLE, enable);
+		
+		// hidden subtrees are left out of the bounds of their parents
+		if (visible && registered_context->updating_on_workers)
+		{
+			arena.setFlag(slot, SceneArena::CULLING_DEFERRED, true);
+			registered_context->culling_deferred = true;
+		}
+		else if (visible) arena.invalidateCulling(arena.parent[slot]);
+		
+		// a hidden subtree keeps the matrices of when it was hidden
+		if (visible) registered_context->transforms_dirty = true;
 	}
+	
+	markSceneChanged();
+}
 
-	ofNode::clearParent();
+void Node::onPositionChanged()
+{
+	markTransformDirty();
 }
 
-void Node::clearChildren()
+void Node::onOrientationChanged()
 {
-	while (getChildren().size())
-	{
-		getChildren()[0]->dispose();
-	}
+	markTransformDirty();
+}
+
+void Node::onScaleChanged()
+{
+	markTransformDirty();
 }
 
 void Node::clearState()
 {
-	hover = false;
+	num_hovers = 0;
 	focus = false;
 }
 
 void Node::setFocus()
 {
-	focus = true;
-	getContext()->focus_object = this;
+	Context *ctx = getContext();
+	ctx->focus_object = this;
+	ctx->setFocusState(this);
 }
 
 Context* Node::getContext()
 {
+	if (registered_context) return registered_context;
+	
 	Node *p = getParent();
 	if (p) return p->getContext();
 	else return NULL;
 }
 
+bool Node::getLocalBounds(BoundingBox& b) const
+{
+	if (!has_local_bounds) return false;
+	
+	b = local_bounds;
+	return true;
+}
+
 void Node::draw(const Internal &)
 {
 	static Internal intn;
 
 	if (getVisible())
 	{
-		glPushMatrix();
-		glMultMatrixf(getLocalTransformMatrix().getPtr());
+		if (registered_context && registered_context->cullDraw(slot))
+			return;
+		
+		ofPushMatrix();
+		ofMultMatrix(getLocalTransformMatrix());
 
+		// the nodes drawn before may have left their style
+		if (!setsOwnStyle()) GLStateCache::get().restoreStyle();
+		
+		// labels are anchored with the arena, see TextLayout::draw()
+		if (registered_context) registered_context->batch.setTransform(registered_context->arena.global[slot]);
 		draw();
 
-		for (int i = 0; i < children.size(); i++)
+		for (size_t i = 0; i < children.size(); i++)
 		{
 			if (children[i]->getVisible())
 				children[i]->draw(intn);
 		}
 
-		glPopMatrix();
+		ofPopMatrix();
 	}
 }
 
-void Node::update(const Internal &)
+void Node::pushID(int id)
 {
-	static Internal intn;
+	if (hittest_target) hittest_target->pushName(id);
+}
 
-	if (getVisible())
-	{
-		global_matrix = getGlobalTransformMatrix();
-		global_matrix_inverse = global_matrix.getInverse();
+void Node::popID()
+{
+	if (hittest_target) hittest_target->popName();
+}
 
-		update();
+void Node::hitRect(const ofRectangle& r)
+{
+	if (hittest_target) hittest_target->addShape(HitShape::rect(r));
+}
 
-		for (int i = 0; i < children.size(); i++)
-		{
-			if (children[i]->getVisible())
-				children[i]->update(intn);
-		}
-	}
+void Node::hitCircle(const ofVec3f& center, float radius)
+{
+	if (hittest_target) hittest_target->addShape(HitShape::circle(center, radius));
+}
+
+void Node::hitSegment(const ofVec3f& p0, const ofVec3f& p1, float width)
+{
+	if (hittest_target) hittest_target->addShape(HitShape::segment(p0, p1, width));
+}
+
+void Node::hitPolygon(const vector<ofVec3f>& vertices)
+{
+	if (hittest_target) hittest_target->addShape(HitShape::polygon(vertices));
+}
+
+void Node::hitBox(const ofVec3f& min_pos, const ofVec3f& max_pos)
+{
+	if (hittest_target) hittest_target->addShape(HitShape::box(min_pos, max_pos));
+}
+
+void Node::hitOrientedBox(const ofMatrix4x4& m, const ofVec3f& size)
+{
+	if (hittest_target) hittest_target->addShape(HitShape::orientedBox(m, size));
+}
+
+void Node::hitMesh(const ofMesh& mesh)
+{
+	if (hittest_target) hittest_target->addShape(HitShape::fromMesh(mesh));
+}
+
+void Node::hitPoint(const ofVec3f& p, float size)
+{
+	if (hittest_target) hittest_target->addShape(HitShape::point(p, size));
 }
 
 void Node::cancelFocus()
 {
 	Context *ctx = getContext();
-	if (ctx->focus_object == this)
-		getContext()->clearFocus();
+	if (ctx && ctx->focus_object == this)
+		ctx->clearFocus();
 }
 
 // RootNode
 
 RootNode::RootNode() : context(new Context)
 {
+	// the root is never picked, the id is for handles
+	registered_context = context;
+	slot = context->arena.allocate(this);
+	object_id = context->arena.getId(slot);
+	context->root = this;
 }
 
 RootNode::~RootNode()
 {
+	// children the app still owns must not point into the deleted context or root
+	context->unregisterElements(children);
+	
+	for (size_t i = 0; i < children.size(); i++)
+		children[i]->ofNode::clearParent();
+	
+	children.clear();
+	
+	registered_context = NULL;
 	delete context;
 	context = NULL;
 }
@@ -632,54 +3253,89 @@ void RootNode::draw()
 		update();
 	
 	getContext()->prepare();
+	
+	// subtree sizes for the culling stats
+	getContext()->arena.getOrder(slot);
 
-	glPushAttrib(GL_ALL_ATTRIB_BITS);
-	glPushMatrix();
-	ofPushStyle();
+	// the draw calls set only what differs and the scope restores only what changed
+	GLStateCache &gl_state = GLStateCache::get();
+	gl_state.begin();
+	
+	getContext()->render_stats = RenderStats();
 
 	static Internal intn;
 
-	if (getVisible())
+	// labels of every node go to the batch of the root, drawn in one call in
+	// RENDER_IMMEDIATE, and in the order of the nodes with RENDER_BATCHED
+	PrimitiveBatch *prev_batch = PrimitiveBatch::setCurrent(&getContext()->batch);
+
+	if (getVisible() && getContext()->render_mode == RENDER_BATCHED)
 	{
-		glPushMatrix();
-		glMultMatrixf(getLocalTransformMatrix().getPtr());
+		getContext()->drawBatched();
+	}
+	else if (getVisible())
+	{
+		// nodes may have moved in event handlers since update()
+		getContext()->ensureTransforms();
+		
+		const ofRectangle view(getContext()->viewport[0], getContext()->viewport[1], getContext()->viewport[2], getContext()->viewport[3]);
+		getContext()->batch.begin(getContext()->modelViewProjectionMatrix, view);
+		
+		ofPushMatrix();
+		ofMultMatrix(getLocalTransformMatrix());
 
-		for (int i = 0; i < children.size(); i++)
+		for (size_t i = 0; i < children.size(); i++)
 		{
 			if (children[i]->getVisible())
 				children[i]->draw(intn);
 		}
 
-		glPopMatrix();
+		ofPopMatrix();
+		
+		getContext()->batch.end();
 	}
+	
+	PrimitiveBatch::setCurrent(prev_batch);
 
-	ofPopStyle();
-	glPopMatrix();
-	glPopAttrib();
+	gl_state.end();
+	
+	getContext()->render_stats.state_changes = gl_state.getNumChanges() - getContext()->state_changes_base;
 }
 
 void RootNode::update()
 {
 	getContext()->update();
 	
-	glPushAttrib(GL_ALL_ATTRIB_BITS);
-	glPushMatrix();
-	ofPushStyle();
-
-	static Internal intn;
+	// queued input sees the scene that was drawn last frame
+	getContext()->flushInput();
+	
+	// PICKING_CPU may run without any GL context. update() draws nothing, the
+	// scope only keeps style changes of update() code out of the app
+	const bool use_gl = getContext()->requiresGL();
+	if (use_gl) GLStateCache::get().begin();
 
 	if (getVisible())
 	{
-		for (int i = 0; i < children.size(); i++)
-		{
-			if (children[i]->getVisible())
-				children[i]->update(intn);
-		}
+		// every update() sees the global matrices of this frame
+		getContext()->ensureTransforms();
+		
+		getContext()->walking = true;
+		
+		if (getContext()->parallel_update)
+			getContext()->updateParallel();
+		else
+			getContext()->updateSerial();
+		
+		getContext()->walking = false;
+		
+		// nodes changed after the walk passed them
+		getContext()->refreshBounds();
+		
+		if (getContext()->culling)
+			getContext()->updateCullingBounds();
 	}
 
-	ofPopStyle();
-	glPopMatrix();
-	glPopAttrib();
+	if (use_gl) GLStateCache::get().end();
 }
 
 Context* RootNode::getContext()
@@ -707,4 +3363,174 @@ void RootNode::disableAllEvent()
 	getContext()->disableAllEvent();
 }
 
+void RootNode::setPickingMode(PickingMode mode)
+{
+	context->setPickingMode(mode);
+}
+
+PickingMode RootNode::getPickingMode() const
+{
+	return context->picking_mode;
+}
+
+void RootNode::setSpatialIndex(SpatialIndexType type)
+{
+	context->setSpatialIndex(type);
+}
+
+SpatialIndexType RootNode::getSpatialIndex() const
+{
+	return context->spatial_index;
+}
+
+void RootNode::setInputCoalescing(bool yn)
+{
+	context->setInputCoalescing(yn);
+}
+
+bool RootNode::getInputCoalescing() const
+{
+	return context->input_coalescing;
+}
+
+const InputStats& RootNode::getInputStats() const
+{
+	return context->input_stats;
+}
+
+void RootNode::resetInputStats()
+{
+	context->input_stats = InputStats();
+}
+
+void RootNode::setPickCache(bool yn)
+{
+	context->pick_cache_enabled = yn;
+	context->pick_cache.clear();
+}
+
+bool RootNode::getPickCache() const
+{
+	return context->pick_cache_enabled;
+}
+
+const PickCacheStats& RootNode::getPickCacheStats() const
+{
+	return context->pick_cache_stats;
+}
+
+void RootNode::resetPickCacheStats()
+{
+	context->pick_cache_stats = PickCacheStats();
+}
+
+unsigned int RootNode::getSceneVersion() const
+{
+	return context->scene_version;
+}
+
+void RootNode::setParallelUpdate(bool yn, int num_threads)
+{
+	context->parallel_update = yn;
+	context->update_pool.setNumThreads(yn ? num_threads : 1);
+}
+
+bool RootNode::getParallelUpdate() const
+{
+	return context->parallel_update;
+}
+
+void RootNode::setCulling(bool yn)
+{
+	context->culling = yn;
+	context->color_id_dirty = true;
+	context->scene_version++;
+}
+
+bool RootNode::getCulling() const
+{
+	return context->culling;
+}
+
+const CullingStats& RootNode::getCullingStats() const
+{
+	return context->culling_stats;
+}
+
+void RootNode::setRenderMode(RenderMode mode)
+{
+	context->render_mode = mode;
+}
+
+RenderMode RootNode::getRenderMode() const
+{
+	return context->render_mode;
+}
+
+void RootNode::setParallelDraw(bool yn, int num_threads)
+{
+	context->parallel_draw = yn;
+	if (yn) context->draw_pool.setNumThreads(num_threads);
+}
+
+bool RootNode::getParallelDraw() const
+{
+	return context->parallel_draw;
+}
+
+const RenderStats& RootNode::getRenderStats() const
+{
+	return context->render_stats;
+}
+
+void RootNode::queryRect(const ofRectangle& rect, vector<RegionSelection>& result, RegionMode mode)
+{
+	context->queryRegion(rect, NULL, mode, result);
+}
+
+void RootNode::queryLasso(const vector<ofVec2f>& polygon, vector<RegionSelection>& result, RegionMode mode)
+{
+	if (polygon.size() < 3)
+	{
+		result.clear();
+		return;
+	}
+	
+	ofRectangle bounds(polygon[0], 0, 0);
+	for (size_t i = 1; i < polygon.size(); i++)
+		bounds.growToInclude(polygon[i]);
+	
+	context->queryRegion(bounds, &polygon, mode, result);
+}
+
+void RootNode::injectPointerPressed(int pointer, float x, float y, int button)
+{
+	context->pointerPressed(pointer, x, y, button);
+}
+
+void RootNode::injectPointerReleased(int pointer, float x, float y, int button)
+{
+	context->pointerReleased(pointer, x, y, button);
+}
+
+void RootNode::injectPointerMoved(int pointer, float x, float y)
+{
+	context->pointerMoved(pointer, x, y);
+}
+
+void RootNode::injectPointerDragged(int pointer, float x, float y, int button)
+{
+	context->pointerDragged(pointer, x, y, button);
+}
+
+void RootNode::pickupPoints(const vector<ofVec2f>& points, vector<vector<PointSelection> >& result)
+{
+	context->pickupBatch(points, result);
+}
+
+void RootNode::setView(const ofMatrix4x4& modelview, const ofMatrix4x4& projection, const ofRectangle& viewport)
+{
+	context->setView(modelview, projection, viewport);
+}
+
 OFX_INTERACTIVE_PRIMITIVES_END_NAMESPACE
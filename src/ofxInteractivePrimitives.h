@@ -13,16 +13,155 @@ namespace ofxIP = ofxInteractivePrimitives;
 
 #include <assert.h>
 
+#include "core/ofxIPGLStateCache.h"
+#include "core/ofxIPHitShape.h"
+#include "core/ofxIPSpatialIndex.h"
+#include "core/ofxIPTransformKernel.h"
+#include "core/ofxIPThreadPool.h"
+#include "core/ofxIPSceneArena.h"
+#include "core/ofxIPNodePool.h"
+#include "core/ofxIPTextBatch.h"
+#include "core/ofxIPPrimitiveBatch.h"
+
 OFX_INTERACTIVE_PRIMITIVES_START_NAMESPACE
 
 class Context;
 class Node;
 class RootNode;
 
+enum PickingMode
+{
+	// glRenderMode(GL_SELECT), needs a compatibility profile GL context.
+	// PICKING_COLOR_ID is used instead with ofGLProgrammableRenderer
+	PICKING_GL_SELECT,
+	
+	// ray-casts the shapes declared with Node::hitRect() etc. on the CPU, no GL context needed
+	PICKING_CPU,
+	
+	// renders hittest() once per frame into an offscreen buffer with the name stacks
+	// encoded as colors. picks read back the pick region, so only visible surfaces are hit
+	PICKING_COLOR_ID
+};
+
+enum SpatialIndexType
+{
+	// hittest every registered node
+	SPATIAL_INDEX_NONE,
+	
+	// bounding volume hierarchy over world space bounds, for 3D scenes
+	SPATIAL_INDEX_BVH,
+	
+	// uniform grid over projected screen space bounds, for 2D overlays
+	SPATIAL_INDEX_GRID
+};
+
+enum RenderMode
+{
+	// each node draws itself with the GL matrix of its transform
+	RENDER_IMMEDIATE,
+	
+	// nodes overriding Node::drawBatched() share world space vertex buffers,
+	// the others are drawn in between like in RENDER_IMMEDIATE
+	RENDER_BATCHED
+};
+
+enum RegionMode
+{
+	// items whose hit shapes are entirely inside the region
+	REGION_CONTAIN,
+	
+	// items whose hit shapes touch the region
+	REGION_OVERLAP
+};
+
+struct RegionSelection
+{
+	Node *node;
+	
+	// ids pushed with pushID() below the node, empty for the node itself
+	vector<GLuint> name_stack;
+};
+
+struct PointSelection
+{
+	Node *node;
+	
+	// ids pushed with pushID() below the node
+	vector<GLuint> name_stack;
+	
+	// window depth in 0..1
+	float depth;
+};
+
+struct InputStats
+{
+	unsigned int events_received;
+	unsigned int events_coalesced;
+	
+	// picks run, and picks answered by the queue or the per frame pick memo
+	unsigned int picks;
+	unsigned int picks_saved;
+	
+	InputStats() : events_received(0), events_coalesced(0), picks(0), picks_saved(0) {}
+};
+
+struct PickCacheStats
+{
+	unsigned int hits;
+	unsigned int misses;
+	
+	PickCacheStats() : hits(0), misses(0) {}
+};
+
+struct CullingStats
+{
+	// nodes skipped by draw() and by picks since the last update()
+	unsigned int draw_culled;
+	unsigned int pick_culled;
+	
+	CullingStats() : draw_culled(0), pick_culled(0) {}
+};
+
+struct RenderStats
+{
+	// of the last draw() with RENDER_BATCHED
+	unsigned int draw_calls;
+	unsigned int batched_nodes;
+	unsigned int immediate_nodes;
+	
+	// states set through GLStateCache from update() to the end of draw(), picks included
+	unsigned int state_changes;
+	
+	RenderStats() : draw_calls(0), batched_nodes(0), immediate_nodes(0), state_changes(0) {}
+};
+
+// weak reference to a registered node. resolves to NULL once the node is disposed,
+// even when its id was handed to a new node. must not outlive its RootNode
+class NodeHandle
+{
+public:
+
+	NodeHandle() : context(NULL), id(0) {}
+	NodeHandle(Node *o);
+	
+	Node* get() const;
+	bool isValid() const { return get() != NULL; }
+	void reset() { context = NULL; id = 0; }
+	
+	operator Node*() const { return get(); }
+	Node* operator->() const { return get(); }
+
+private:
+
+	Context *context;
+	unsigned int id;
+};
+
 class Node : public ofNode
 {
 	friend class RootNode;
 	friend class Context;
+	friend class NodeHandle;
 	
 public:
 
@@ -34,6 +173,23 @@ public:
 	virtual void update() {}
 	virtual void draw() {}
 	virtual void hittest() {}
+	
+	// the same as draw() through the batch, for RootNode::setRenderMode(RENDER_BATCHED).
+	// returns false without adding anything to be drawn with draw() instead, which
+	// flushes the batch first. nodes drawing nothing should return true, so they do
+	// not split the batch
+	virtual bool drawBatched(PrimitiveBatch & /* batch */) { return false; }
+	
+	// true when update() only touches this node and its children, and does not add or
+	// remove nodes. then RootNode::setParallelUpdate() may run it on a worker thread.
+	// subclasses overriding update() have to declare it again
+	virtual bool isUpdateThreadSafe() const { return false; }
+	
+	// true when draw() sets every style it draws with through GLStateCache. RootNode::draw()
+	// restores the style of the app before the other nodes, and skips that for these so
+	// runs of them only change what differs between them. subclasses overriding draw()
+	// have to declare it again
+	virtual bool setsOwnStyle() const { return false; }
 
 	virtual void mousePressed(int x, int y, int button)
 	{
@@ -77,36 +233,85 @@ public:
 
 	virtual void keyPressed(int key) {}
 	virtual void keyReleased(int key) {}
+	
+	// the first pointer came over the node or the last one left it, not passed to the parent
+	virtual void mouseEntered() {}
+	virtual void mouseExited() {}
+	
+	// pointer handlers for multi pointer input, the mouse is pointer 0.
+	// they call the mouse handlers unless overridden
+	virtual void pointerPressed(int /* pointer */, int x, int y, int button) { mousePressed(x, y, button); }
+	virtual void pointerReleased(int /* pointer */, int x, int y, int button) { mouseReleased(x, y, button); }
+	virtual void pointerMoved(int /* pointer */, int x, int y) { mouseMoved(x, y); }
+	virtual void pointerDragged(int /* pointer */, int x, int y, int button) { mouseDragged(x, y, button); }
 
 public: // hierarchy
 
+	// stays without a parent, with an error logged, when the scene has no ids left for the subtree
 	void setParent(Node *o);
 	Node* getParent() { return (Node*)ofNode::getParent(); }
 	bool hasParent() { return ofNode::getParent() != NULL; }
 	void clearParent();
 	
-	vector<Node*> getChildren() { return children; }
+	// in draw order. copy it to iterate while children are added or removed
+	const vector<Node*>& getChildren() const { return children; }
+	
+	inline size_t getNumChildren() const { return children.size(); }
+	inline Node* getChild(size_t index) const { return children[index]; }
+	
+	// dispose() every child in one pass
 	void clearChildren();
 	
+	// siblings are drawn by layer, higher layers on top, and picks at the same
+	// depth go to the node on top. a node added or moved to a layer goes on top of it
+	void setLayer(int layer);
+	int getLayer() const { return layer; }
+	
+	// on top of or below the siblings of the same layer, without reparenting
+	void bringToFront() { reorder(true); }
+	void sendToBack() { reorder(false); }
+	
 public: // state
 
-	inline void setVisible(bool v) { visible = v; }
+	inline void setVisible(bool v) { if (visible != v) { visible = v; onStateChanged(); } }
 	inline bool getVisible() const { return visible; }
 	inline bool isVisible() const { return visible; }
 
-	inline bool isHover() const { return hover; }
-	inline bool isDown() const { return down; }
+	// under any pointer, or under the given one
+	inline bool isHover() const { return num_hovers > 0; }
+	bool isHover(int pointer) const;
+	inline bool isDown() const { return !down_pointers.empty(); }
+	bool isDown(int pointer) const;
 
 	inline bool isFocus() const { return focus; }
 	inline bool hasFocus() const { return focus; }
 	void setFocus();
 	
-	inline void setEnable(bool v) { enable = v; }
+	// call when hittest() changes without a transform or state change of the node
+	void markHitShapeDirty();
+	
+	// record the shapes of hittest() once and replay them on every pick until
+	// markHitShapeDirty(). raw GL calls in hittest() are not recorded
+	void setHitShapeCaching(bool yn);
+	inline bool getHitShapeCaching() const { return hit_shape_cache != NULL; }
+	
+	inline void setEnable(bool v) { if (enable != v) { enable = v; onStateChanged(); } }
 	inline bool getEnable() { return enable; }
 	inline bool isEnable() { return enable; }
 	
+	// local bounds of everything the node draws and hit tests. with RootNode::setCulling()
+	// subtrees outside the view are not drawn or picked. a node without bounds (the default)
+	// is never culled and neither are its parents, empty bounds mean it draws nothing.
+	// overrides call markHitShapeDirty() when their bounds change
+	void setLocalBounds(const BoundingBox& b) { local_bounds = b; has_local_bounds = true; markHitShapeDirty(); }
+	void clearLocalBounds() { has_local_bounds = false; markHitShapeDirty(); }
+	virtual bool getLocalBounds(BoundingBox& b) const;
+	
 public: // utils
 
+	// a weak reference, invalid while the node is not in a scene
+	NodeHandle getHandle() { return NodeHandle(this); }
+	
 	ofVec2f getMouseDelta();
 	ofVec3f localToGlobalPos(const ofVec3f& v);
 	ofVec3f globalToLocalPos(const ofVec3f& v);
@@ -118,25 +323,74 @@ protected:
 
 	struct Internal {};
 	void draw(const Internal &);
-	void update(const Internal &);
 
 	virtual Context* getContext();
 	const vector<GLuint>& getCurrentNameStack();
 	
-	inline void pushID(int id) { glPushName(id); }
-	inline void popID() { glPopName(); }
+	// pointer of the event being handled
+	int getCurrentPointer();
+	
+	void pushID(int id);
+	void popID();
+	
+	// hit shapes for hittest(). unlike raw GL calls they can be cached with setHitShapeCaching()
+	// and work with every PickingMode (raw GL calls need PICKING_GL_SELECT or PICKING_COLOR_ID)
+	void hitRect(const ofRectangle& r);
+	void hitRect(float x, float y, float w, float h) { hitRect(ofRectangle(x, y, w, h)); }
+	void hitCircle(const ofVec3f& center, float radius);
+	void hitSegment(const ofVec3f& p0, const ofVec3f& p1, float width = 1);
+	void hitPolygon(const vector<ofVec3f>& vertices);
+	void hitBox(const ofVec3f& min_pos, const ofVec3f& max_pos);
+	void hitOrientedBox(const ofMatrix4x4& m, const ofVec3f& size);
+	
+	// with caching, the vertices and indices are copied once until markHitShapeDirty()
+	void hitMesh(const ofMesh& mesh);
+	void hitPoint(const ofVec3f& p, float size);
 
 	void cancelFocus();
 	
+	// ofNode callbacks, overrides must call these
+	void onPositionChanged();
+	void onOrientationChanged();
+	void onScaleChanged();
+	
 private:
 
 	unsigned int object_id;
-	bool hover, down, focus, visible, enable;
+	Context *registered_context;
+	
+	// matrices, bounds and links in the SceneArena of the context, NONE until registered
+	int slot;
+	
+	// pointers whose last event was over the node
+	int num_hovers;
+	
+	bool focus, visible, enable;
+	vector<int> down_pointers;
 
-	ofMatrix4x4 global_matrix, global_matrix_inverse;
 	vector<Node*> children;
+	int layer;
+	
+	BoundingBox local_bounds;
+	bool has_local_bounds;
+	
+	HitShapeRecorder *hit_shape_cache;
+	bool hit_shape_cache_dirty;
 
+	// children stay sorted by layer, returns the position of o
+	size_t insertChild(Node *o, bool front);
+	void reorder(bool front);
+	
 	void clearState();
+	void markSceneChanged();
+	void markTransformDirty();
+	void onStateChanged();
+	
+	// runs hittest() into hittest_target, or replays the cached shapes
+	void issueHitShapes();
+	const HitShapeRecorder& recordHitShapes(HitShapeRecorder &recorder);
+	
+	static HitTestTarget *hittest_target;
 
 };
 
@@ -155,6 +409,79 @@ public:
 	
 	void enableAllEvent();
 	void disableAllEvent();
+	
+	void setPickingMode(PickingMode mode);
+	PickingMode getPickingMode() const;
+	
+	// camera for picking without draw(), e.g. headless with PICKING_CPU
+	void setView(const ofMatrix4x4& modelview, const ofMatrix4x4& projection, const ofRectangle& viewport);
+	
+	// picks only hittest the nodes whose bounds overlap the pick region. bounds come
+	// from the cached hit shapes (see Node::setHitShapeCaching()) or the local bounds,
+	// nodes without them are always tested. gathering the bounds does not call hittest()
+	void setSpatialIndex(SpatialIndexType type);
+	SpatialIndexType getSpatialIndex() const;
+	
+	// queue mouse events and dispatch them in update(). consecutive moves and drags
+	// are collapsed, and each cursor position is picked at most once per frame
+	void setInputCoalescing(bool yn);
+	bool getInputCoalescing() const;
+	
+	const InputStats& getInputStats() const;
+	void resetInputStats();
+	
+	// reuse picks of the same cursor position until the scene version changes.
+	// nodes whose hittest() depends on outside state must call markHitShapeDirty()
+	void setPickCache(bool yn);
+	bool getPickCache() const;
+	
+	const PickCacheStats& getPickCacheStats() const;
+	void resetPickCacheStats();
+	
+	unsigned int getSceneVersion() const;
+	
+	// nodes and pushID() sub items inside a marquee or lasso in screen coordinates.
+	// tests the projected hit shapes, so nodes drawing their hit area with raw GL are not found
+	void queryRect(const ofRectangle& rect, vector<RegionSelection>& result, RegionMode mode = REGION_OVERLAP);
+	void queryLasso(const vector<ofVec2f>& polygon, vector<RegionSelection>& result, RegionMode mode = REGION_OVERLAP);
+	
+	// input from pointers other than the mouse, e.g. touches or tracked hands.
+	// each pointer captures the node it pressed until it is released
+	void injectPointerPressed(int pointer, float x, float y, int button = 0);
+	void injectPointerReleased(int pointer, float x, float y, int button = 0);
+	void injectPointerMoved(int pointer, float x, float y);
+	void injectPointerDragged(int pointer, float x, float y, int button = 0);
+	
+	// picks many screen points (tracked hands, touches) in one pass over the scene.
+	// result[i] holds the hits of points[i], nearest first. hit shapes are ray-cast,
+	// so raw GL hittest() code is only found with PICKING_COLOR_ID
+	void pickupPoints(const vector<ofVec2f>& points, vector<vector<PointSelection> >& result);
+	
+	// update thread safe subtrees on a work stealing thread pool. the other nodes are
+	// updated first on the calling thread in the serial order, and the hit shape bounds
+	// after all of them. num_threads includes the calling thread, 0 uses every core
+	void setParallelUpdate(bool yn, int num_threads = 0);
+	bool getParallelUpdate() const;
+	
+	// skip subtrees outside the view in draw() and outside the pick region in picks,
+	// see Node::setLocalBounds(). bounds are gathered in update()
+	void setCulling(bool yn);
+	bool getCulling() const;
+	
+	const CullingStats& getCullingStats() const;
+	
+	// RENDER_BATCHED draws the built-in primitives in a few draw calls, see Node::drawBatched()
+	void setRenderMode(RenderMode mode);
+	RenderMode getRenderMode() const;
+	
+	// with RENDER_BATCHED, run drawBatched() of large scenes on a thread pool. the visible
+	// nodes are split into ranges recorded in parallel, then drawn on this thread in
+	// tree order. drawBatched() must then only read its node and write the batch.
+	// num_threads includes the calling thread, 0 uses every core
+	void setParallelDraw(bool yn, int num_threads = 0);
+	bool getParallelDraw() const;
+	
+	const RenderStats& getRenderStats() const;
 
 protected:
 
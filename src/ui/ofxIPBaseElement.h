@@ -19,7 +19,24 @@ public:
 	float getContentHeight() const { return rect.height; }
 
 	const ofRectangle& getContentRect() const { return rect; }
-	void setContentRect(const ofRectangle& o) { rect = o; }
+	
+	// the content rect unless setLocalBounds() was called, none while it is empty
+	bool getLocalBounds(BoundingBox& b) const
+	{
+		if (Node::getLocalBounds(b)) return true;
+		if (rect.width == 0 && rect.height == 0) return false;
+		
+		b = BoundingBox(ofVec3f(rect.x, rect.y, 0), ofVec3f(rect.x + rect.width, rect.y + rect.height, 0));
+		return true;
+	}
+	// marks the hit shape dirty for subclasses that cache it
+	void setContentRect(const ofRectangle& o)
+	{
+		if (rect == o) return;
+		
+		rect = o;
+		markHitShapeDirty();
+	}
 	
 private:
 	
@@ -9,6 +9,8 @@ OFX_INTERACTIVE_PRIMITIVES_START_NAMESPACE
 class Button : public StringBox
 {
 public:
+
+	OFX_INTERACTIVE_PRIMITIVES_POOLED_NODE(Button)
 	
 	ofEvent<ofEventArgs> pressed;
 
@@ -20,28 +22,57 @@ public:
 
 	void draw()
 	{
+		GLStateCache &gl_state = GLStateCache::get();
+		
 		if (isDown())
 		{
-			ofFill();
-			ofSetColor(0, 255, 0);
+			gl_state.setFill(true);
+			gl_state.setColor(0, 255, 0);
 			ofDrawRectangle(getContentRect());
 
-			ofSetColor(0, 127, 0);
+			gl_state.setColor(0, 127, 0);
 		}
 		else if (isHover())
 		{
-			ofNoFill();
-			ofSetColor(255, 0, 255);
+			gl_state.setFill(false);
+			gl_state.setColor(255, 0, 255);
 			ofDrawRectangle(getContentRect());
 		}
 		else
 		{
-			ofNoFill();
-			ofSetColor(0, 255, 0);
+			gl_state.setFill(false);
+			gl_state.setColor(0, 255, 0);
 			ofDrawRectangle(getContentRect());
 		}
 
-		ofDrawBitmapString(text, getMargin(), Font::CHAR_HEIGHT + getMargin());
+		text_layout.draw(getMargin(), Font::CHAR_HEIGHT + getMargin());
+	}
+	
+	bool drawBatched(PrimitiveBatch &batch)
+	{
+		if (isDown())
+		{
+			batch.setFill(true);
+			batch.setColor(0, 255, 0);
+			batch.drawRectangle(getContentRect());
+			
+			batch.setColor(0, 127, 0);
+		}
+		else if (isHover())
+		{
+			batch.setFill(false);
+			batch.setColor(255, 0, 255);
+			batch.drawRectangle(getContentRect());
+		}
+		else
+		{
+			batch.setFill(false);
+			batch.setColor(0, 255, 0);
+			batch.drawRectangle(getContentRect());
+		}
+		
+		batch.drawText(text_layout, getMargin(), Font::CHAR_HEIGHT + getMargin());
+		return true;
 	}
 	
 	void mousePressed(int x, int y, int button)
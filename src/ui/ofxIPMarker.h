@@ -10,58 +10,82 @@ class Marker : public Node
 {
 public:
 
+	OFX_INTERACTIVE_PRIMITIVES_POOLED_NODE(Marker)
+
 	Marker(Node &parent) : Node()
 	{
 		setParent(&parent);
+		setHitShapeCaching(true);
 	}
 
 	void draw()
 	{
-		ofNoFill();
-
-		if (isDown())
-			ofSetColor(255, 0, 0);
-		else
-			ofSetColor(255, 0, 0);
+		GLStateCache &gl_state = GLStateCache::get();
+		
+		gl_state.setFill(false);
+		gl_state.setColor(255, 0, 0);
 
 		ofDrawLine(-10, 0, 10, 0);
 		ofDrawLine(0, -10, 0, 10);
 
 		if (isDown())
-		{
-			ofNoFill();
-			ofSetColor(255, 0, 0);
 			ofDrawRectangle(-6, -6, 12, 12);
-		}
 		else if (isHover())
-		{
-			ofNoFill();
-			ofSetColor(255, 0, 0);
 			ofDrawRectangle(-3, -3, 6, 6);
-		}
 
-		ofSetColor(0, 255, 0);
-		ofDrawBitmapString(text, 4, 14);
+		gl_state.setColor(0, 255, 0);
+		text_layout.draw(4, 14);
+	}
+	
+	bool drawBatched(PrimitiveBatch &batch)
+	{
+		batch.setFill(false);
+		batch.setColor(255, 0, 0);
+		
+		batch.drawLine(-10, 0, 10, 0);
+		batch.drawLine(0, -10, 0, 10);
+		
+		if (isDown())
+			batch.drawRectangle(-6, -6, 12, 12);
+		else if (isHover())
+			batch.drawRectangle(-3, -3, 6, 6);
+		
+		batch.setColor(0, 255, 0);
+		batch.drawText(text_layout, 4, 14);
+		return true;
 	}
 
 	void hittest()
 	{
-		ofFill();
-		ofDrawRectangle(-15, -15, 30, 30);
+		hitRect(-15, -15, 30, 30);
 	}
+	
+	bool isUpdateThreadSafe() const { return true; }
+	bool setsOwnStyle() const { return true; }
 
 	void mouseDragged(int x, int y, int button)
 	{
 		move(getMouseDelta());
 	}
 
-	void setText(const string& s) { text = s; }
+	void setText(const string& s) { text = s; text_layout.setText(s); }
 	const string& getText() { return text; }
 
 protected:
 
 	string text;
+	TextLayout text_layout;
 
 };
 
+//
+
+inline Marker* makeMarker(Node &parent, const ofVec3f& pos, const string& text = "")
+{
+	Marker* o = new Marker(parent);
+	o->setPosition(pos);
+	o->setText(text);
+	return o;
+}
+
 OFX_INTERACTIVE_PRIMITIVES_END_NAMESPACE
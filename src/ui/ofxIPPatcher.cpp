@@ -28,19 +28,17 @@ void PatchCord::draw()
 	const ofVec3f p0 = getUpstream()->getPos();
 	const ofVec3f p1 = getUpstream()->getPatchObject()->globalToLocalPos(getDownstream()->getGlobalPos());
 
-	ofPushStyle();
+	GLStateCache &gl_state = GLStateCache::get();
+	gl_state.begin();
 	
-	if (this->isHover())
-		ofSetLineWidth(2);
-	else
-		ofSetLineWidth(1);
+	gl_state.setLineWidth(this->isHover() ? 2 : 1);
 	
 	if (this->isFocus())
-		ofSetColor(ofColor::fromHex(0xCCFF77), 127);
+		gl_state.setColor(ofColor(ofColor::fromHex(0xCCFF77), 127));
 
 	ofDrawLine(p0, p1);
 	
-	ofPopStyle();
+	gl_state.end();
 }
 
 void PatchCord::hittest()
@@ -50,8 +48,7 @@ void PatchCord::hittest()
 	const ofVec3f p0 = getUpstream()->getPos();
 	const ofVec3f p1 = getUpstream()->getPatchObject()->globalToLocalPos(getDownstream()->getGlobalPos());
 	
-	ofSetLineWidth(3);
-	ofDrawLine(p0, p1);
+	hitSegment(p0, p1, 3);
 }
 
 void PatchCord::keyPressed(int key)
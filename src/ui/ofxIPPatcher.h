@@ -193,6 +193,8 @@ class PatchCord : public Node, public DelayedDeletable
 	friend class Port;
 	
 public:
+
+	OFX_INTERACTIVE_PRIMITIVES_POOLED_NODE(PatchCord)
 	
 	PatchCord(Port *upstream_port, Port *downstream_port);
 	~PatchCord() {}
@@ -364,6 +366,7 @@ public:
 		disposePatchCords();
 		T::setupPatchObject(this);
 		alignPort();
+		this->markHitShapeDirty();
 	}
 	
 	~PatchObject()
@@ -382,12 +385,14 @@ public:
 	Port& addInput(const string& desc = "")
 	{
 		input_port.push_back(Port(this, input_port.size(), PortIdentifer::INPUT, desc));
+		this->markHitShapeDirty();
 		return input_port.back();
 	}
 	
 	Port& addOutput(const string& desc = "")
 	{
 		output_port.push_back(Port(this, input_port.size(), PortIdentifer::OUTPUT, desc));
+		this->markHitShapeDirty();
 		return output_port.back();
 	}
 	
@@ -439,22 +444,20 @@ public:
 	
 	void draw()
 	{
-		ofPushStyle();
+		GLStateCache &gl_state = GLStateCache::get();
+		gl_state.begin();
 		
 		InteractivePrimitiveType::draw();
 		
 		{
-			ofPushStyle();
+			gl_state.begin();
 			
-			if (this->isHover())
-				ofSetLineWidth(2);
-			else
-				ofSetLineWidth(1);
+			gl_state.setLineWidth(this->isHover() ? 2 : 1);
 			
 			if (this->isFocus())
-				ofSetColor(ofColor::fromHex(0xCCFF77), 127);
+				gl_state.setColor(ofColor(ofColor::fromHex(0xCCFF77), 127));
 
-			ofNoFill();
+			gl_state.setFill(false);
 			
 			ofRectangle r = this->getContentRect();
 			r.x -= 2;
@@ -464,7 +467,7 @@ public:
 			
 			ofDrawRectangle(r);
 			
-			ofPopStyle();
+			gl_state.end();
 		}
 		
 		const vector<GLuint>& names = this->getCurrentNameStack();
@@ -492,7 +495,7 @@ public:
 			ofDrawRectangle(r);
 		}
 		
-		ofFill();
+		gl_state.setFill(true);
 		
 		for (size_t i = 0; i < getNumInput(); i++)
 		{
@@ -509,22 +512,20 @@ public:
 			ofLine(patching_port->getPos(), this->globalToLocalPos(ofVec2f(ofGetMouseX(), ofGetMouseY())));
 		}
 		
-		ofPopStyle();
+		gl_state.end();
 	}
 	
 	void hittest()
 	{
 		InteractivePrimitiveType::hittest();
 		
-		ofFill();
-		
 		// input
 		this->pushID(PortIdentifer::INPUT);
 		
 		for (size_t i = 0; i < getNumInput(); i++)
 		{
 			this->pushID(i);
-			getInputPort(i).hittest();
+			this->hitRect(getInputPort(i).getRect());
 			this->popID();
 		}
 		
@@ -536,7 +537,7 @@ public:
 		for (size_t i = 0; i < getNumOutput(); i++)
 		{
 			this->pushID(i);
-			getOutputPort(i).hittest();
+			this->hitRect(getOutputPort(i).getRect());
 			this->popID();
 		}
 		
@@ -571,6 +572,9 @@ public:
 		}
 		else
 		{
+			// the dragged object draws over the others
+			this->bringToFront();
+			
 			InteractivePrimitiveType::mousePressed(x, y, button);
 		}
 		
@@ -648,10 +652,31 @@ public:
 	void updateDisplay()
 	{
 		alignPort();
+		this->markHitShapeDirty();
+	}
+	
+	// the ports stick out of the content rect
+	bool getLocalBounds(BoundingBox& b) const
+	{
+		if (!InteractivePrimitiveType::getLocalBounds(b)) return false;
+		
+		for (size_t i = 0; i < input_port.size(); i++)
+			addRect(b, input_port[i].rect);
+		
+		for (size_t i = 0; i < output_port.size(); i++)
+			addRect(b, output_port[i].rect);
+		
+		return true;
 	}
 	
 protected:
 	
+	static void addRect(BoundingBox& b, const ofRectangle& r)
+	{
+		b.add(ofVec3f(r.x, r.y, 0));
+		b.add(ofVec3f(r.x + r.width, r.y + r.height, 0));
+	}
+	
 	void disposePatchCords()
 	{
 		struct disconnect
@@ -9,41 +9,57 @@ OFX_INTERACTIVE_PRIMITIVES_START_NAMESPACE
 class Slider : public Element2D
 {
 public:
+
+	OFX_INTERACTIVE_PRIMITIVES_POOLED_NODE(Slider)
 	
 	ofEvent<float> valueUpdated;
 	
 	Slider(Node &root) : Element2D(root), label(*this), value(0), min(0), max(1), slider_width(0)
 	{
+		setHitShapeCaching(true);
 		setContentRect(ofRectangle(0, 0, 100, 12));
 	}
 	
 	void update()
 	{
 		label.setText(ofToString(value));
-		label.setPosition(getContentWidth(), 1, 0);
+		
+		const ofVec3f label_pos(getContentWidth(), 1, 0);
+		if (label.getPosition() != label_pos) label.setPosition(label_pos);
 	}
 	
+	bool setsOwnStyle() const { return true; }
+	
 	void draw()
 	{
-		ofPushStyle();
-		
-		ofNoFill();
+		GLStateCache &gl_state = GLStateCache::get();
+		gl_state.restoreColor();
+		gl_state.setFill(false);
 		ofDrawRectangle(getContentRect());
 		
-		ofFill();
+		gl_state.setFill(true);
 		ofRectangle r = getContentRect();
 		r.width = slider_width * getContentWidth();
 		ofDrawRectangle(r);
+	}
+	
+	bool drawBatched(PrimitiveBatch &batch)
+	{
+		batch.setFill(false);
+		batch.drawRectangle(getContentRect());
+		
+		batch.setFill(true);
+		ofRectangle r = getContentRect();
+		r.width = slider_width * getContentWidth();
+		batch.drawRectangle(r);
 		
-		ofPopStyle();
+		return true;
 	}
 	
 	void hittest()
 	{
-		ofFill();
-		
 		pushID(0);
-		ofDrawRectangle(getContentRect());
+		hitRect(getContentRect());
 		popID();
 	}
 	
@@ -11,6 +11,8 @@ OFX_INTERACTIVE_PRIMITIVES_START_NAMESPACE
 class String : public Element2D
 {
 public:
+
+	OFX_INTERACTIVE_PRIMITIVES_POOLED_NODE(String)
 	
 	enum
 	{
@@ -21,47 +23,129 @@ public:
 
 	String(Node &parent) : Element2D(parent) {}
 	
+	// drawn in the color of the app
+	bool setsOwnStyle() const { return true; }
+	
 	void draw()
 	{
-		ofPushStyle();
-		ofDrawBitmapString(text, 1, CHAR_HEIGHT + 1);
-		ofPopStyle();
+		GLStateCache::get().restoreColor();
+		text_layout.draw(1, CHAR_HEIGHT + 1);
+	}
+	
+	bool drawBatched(PrimitiveBatch &batch)
+	{
+		batch.drawText(text_layout, 1, CHAR_HEIGHT + 1);
+		return true;
 	}
 
-	void setText(const string& s) { text = s; onUpdateText(); }
+	void setText(const string& s)
+	{
+		if (s == text) return;
+		
+		text = s;
+		text_layout.setText(s);
+		
+		// the local bounds follow the text
+		markHitShapeDirty();
+		onUpdateText();
+	}
+	
 	const string& getText() const { return text; }
 	
+	// the content rect, or the text when it has none
+	bool getLocalBounds(BoundingBox& b) const
+	{
+		if (Element2D::getLocalBounds(b)) return true;
+		
+		const ofRectangle r = getTextRect(1);
+		b = BoundingBox(ofVec3f(r.x, r.y, 0), ofVec3f(r.x + r.width, r.y + r.height, 0));
+		return true;
+	}
+	
 protected:
 	
 	string text;
 	
+	// glyph quads of the text, laid out by setText()
+	TextLayout text_layout;
+	
 	virtual void onUpdateText() {}
+	
+	// the bitmap font extent of the text with margin around it
+	ofRectangle getTextRect(float margin) const
+	{
+		int w = 0;
+		int h = 1;
+		int max_w = 0;
+		
+		for (size_t i = 0; i < text.size(); i++)
+		{
+			char c = text[i];
+			if (c == '\n')
+			{
+				max_w = max(max_w, w);
+				
+				w = 0;
+				h++;
+			}
+			else
+			{
+				w++;
+			}
+		}
+		
+		max_w = max(max_w, w);
+		
+		ofRectangle rect;
+		rect.y = -1;
+		rect.width = max_w * CHAR_WIDTH;
+		rect.height = h * CHAR_HEIGHT + (h - 1) * NEWLINE_HEIGHT;
+		
+		rect.width += margin * 2 + 1;
+		rect.height += margin * 2 + 1;
+		
+		return rect;
+	}
 };
 
 class StringBox : public String
 {
 public:
 
+	OFX_INTERACTIVE_PRIMITIVES_POOLED_NODE(StringBox)
+
 	typedef String Font;
 
-	StringBox(Node &parent) : String(parent), margin(1) {}
+	// sized for the empty text, so it can be picked before any setText().
+	// hittest() only uses the content rect, so its hit shape is cached
+	StringBox(Node &parent) : String(parent), margin(1)
+	{
+		setHitShapeCaching(true);
+		updateContentRect();
+	}
 
 	void draw()
 	{
-		ofPushStyle();
-		
-		ofNoFill();
+		GLStateCache &gl_state = GLStateCache::get();
+		gl_state.restoreColor();
+		gl_state.setFill(false);
 		ofDrawRectangle(getContentRect());
 
-		ofDrawBitmapString(text, margin, Font::CHAR_HEIGHT + margin);
+		text_layout.draw(margin, Font::CHAR_HEIGHT + margin);
+	}
+	
+	bool drawBatched(PrimitiveBatch &batch)
+	{
+		batch.setFill(false);
+		batch.drawRectangle(getContentRect());
 		
-		ofPopStyle();
+		batch.drawText(text_layout, margin, Font::CHAR_HEIGHT + margin);
+		return true;
 	}
 
 	void hittest()
 	{
-		ofFill();
-		ofDrawRectangle(getContentRect());
+		hitRect(getContentRect());
 	}
 
 	float getMargin() const { return margin; }
@@ -76,37 +160,7 @@ protected:
 	
 	void updateContentRect()
 	{
-		int w = 0;
-		int h = 1;
-		int max_w = 0;
-		
-		for (int i = 0; i < text.size(); i++)
-		{
-			char c = text[i];
-			if (c == '\n')
-			{
-				max_w = max(max_w, w);
-				
-				w = 0;
-				h++;
-			}
-			else
-			{
-				w++;
-			}
-		}
-		
-		max_w = max(max_w, w);
-		
-		ofRectangle rect;
-		rect.y = -1;
-		rect.width = max_w * Font::CHAR_WIDTH;
-		rect.height = h * Font::CHAR_HEIGHT + (h - 1) * Font::NEWLINE_HEIGHT;
-		
-		rect.width += margin * 2 + 1;
-		rect.height += margin * 2 + 1;
-		
-		setContentRect(rect);
+		setContentRect(getTextRect(margin));
 	}
 	
 private:
@@ -119,6 +173,8 @@ private:
 class DraggableStringBox : public StringBox
 {
 public:
+
+	OFX_INTERACTIVE_PRIMITIVES_POOLED_NODE(DraggableStringBox)
 	
 	DraggableStringBox(Node &parent) : StringBox(parent) {}
 	
@@ -15,12 +15,16 @@ public:
 		setParent(&root);
 	}
 	
+	// with a static mesh, setHitShapeCaching(true) saves re-issuing a shape
+	// per vertex on every pick. call markHitShapeDirty() when the vertices move
 	void setup(ofMesh *mesh, int num_control_point)
 	{
 		this->mesh = mesh;
 		
 		indexes.resize(num_control_point);
 		focus_index = 0;
+		
+		markHitShapeDirty();
 	}
 	
 	void save(const string& path_)
@@ -30,7 +34,7 @@ public:
 		Poco::AutoPtr<Poco::Util::XMLConfiguration> config = new Poco::Util::XMLConfiguration;
 		config->loadEmpty("verts");
 		
-		for (int i = 0; i < indexes.size(); i++)
+		for (int i = 0; i < (int)indexes.size(); i++)
 		{
 			string t = "vert[" + ofToString(i) + "]";
 			config->setInt(t + "[@index]", i);
@@ -54,7 +58,7 @@ public:
 		
 		indexes.resize(keys.size());
 		
-		for (int i = 0; i < keys.size(); i++)
+		for (int i = 0; i < (int)keys.size(); i++)
 		{
 			string t = "vert[" + ofToString(i) + "]";
 			int idx = config->getInt(t + "[@index]");
@@ -69,7 +73,7 @@ public:
 	// focus
 	void changeFocus(int index)
 	{
-		assert(index >= 0 && index < indexes.size());
+		assert(index >= 0 && index < (int)indexes.size());
 		focus_index = index;
 	}
 	
@@ -91,7 +95,7 @@ public:
 	ofVec3f getVertexPosition(size_t index) const
 	{
 		assert(mesh);
-		assert(indexes[index] < mesh->getNumVertices());
+		assert((size_t)indexes[index] < mesh->getNumVertices());
 		return mesh->getVertex(indexes[index]);
 	}
 	
@@ -99,31 +103,33 @@ public:
 	
 	void draw()
 	{
-		ofPushStyle();
-		ofEnableAlphaBlending();
+		GLStateCache &gl_state = GLStateCache::get();
+		gl_state.begin();
+		gl_state.setBlendMode(OF_BLENDMODE_ALPHA);
 		
-		ofNoFill();
+		gl_state.setFill(false);
 		
-		ofSetColor(255, 64);
+		gl_state.setColor(255, 255, 255, 64);
 		mesh->drawWireframe();
 		
-		for (int i = 0; i < indexes.size(); i++)
+		// the labels of all points in one draw call, after the boxes
+		label_batch.begin();
+		
+		for (int i = 0; i < (int)indexes.size(); i++)
 		{
-			if (focus_index == i)
-				ofSetColor(255, 0, 0);
-			else
-				ofSetColor(255);
+			const ofColor c = focus_index == i ? ofColor(255, 0, 0) : ofColor(255);
+			gl_state.setColor(c);
 			
 			int idx = indexes[i];
 			ofVec3f p = mesh->getVertex(idx);
 			ofDrawBox(p, 10);
 			
-			stringstream ss;
-			ss << "  " << i << "->" << idx << "\n  (" << p << ")";
-			ofDrawBitmapString(ss.str(), p);
+			label_batch.add(getLabel(i, idx, p), p, c);
 		}
 		
-		ofSetColor(255);
+		label_batch.draw();
+		
+		gl_state.setColor(255, 255, 255);
 		
 		if (isHover())
 		{
@@ -135,28 +141,17 @@ public:
 			ofPopMatrix();
 		}
 		
-		ofPopStyle();
+		gl_state.end();
 	}
 	
 	void hittest()
 	{
-		glPushAttrib(GL_ALL_ATTRIB_BITS);
-		glPointSize(40);
-		
-		for (int i = 0; i < mesh->getNumVertices(); i++)
+		for (int i = 0; i < (int)mesh->getNumVertices(); i++)
 		{
-			ofVec3f p = mesh->getVertex(i);
-			
-			glPushName(i);
-			
-			glBegin(GL_POINTS);
-			glVertex3fv(p.getPtr());
-			glEnd();
-			
-			glPopName();
+			pushID(i);
+			hitPoint(mesh->getVertex(i), 40);
+			popID();
 		}
-		
-		glPopAttrib();
 	}
 	
 	void mousePressed(int x, int y, int button)
@@ -185,6 +180,38 @@ protected:
 	
 	int current_vertex_index;
 	int focus_index;
+	
+	struct Label
+	{
+		int vertex_index;
+		ofVec3f position;
+		TextLayout layout;
+		
+		Label() : vertex_index(-1) {}
+	};
+	
+	// by control point, laid out again when its vertex or the position changes
+	vector<Label> labels;
+	TextBatch label_batch;
+	
+	const TextLayout& getLabel(int i, int idx, const ofVec3f& p)
+	{
+		if (labels.size() != indexes.size()) labels.resize(indexes.size());
+		
+		Label &l = labels[i];
+		
+		if (l.vertex_index != idx || l.position != p)
+		{
+			stringstream ss;
+			ss << "  " << i << "->" << idx << "\n  (" << p << ")";
+			
+			l.vertex_index = idx;
+			l.position = p;
+			l.layout.setText(ss.str());
+		}
+		
+		return l.layout;
+	}
 };
 
 OFX_INTERACTIVE_PRIMITIVES_END_NAMESPACE
\ No newline at end of file